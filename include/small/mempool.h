@@ -111,14 +111,35 @@ struct mslab {
 	uint32_t free_offset;
 	/** Number of available slots in the slab. */
 	uint32_t nfree;
-	/** Used if this slab is a member of hot_slabs tree. */
-	rb_node(struct mslab) next_in_hot;
+	union {
+		/** Used if this slab is a member of hot_slabs tree. */
+		rb_node(struct mslab) next_in_hot;
+		/**
+		 * Used if hot slabs are kept in a pairing heap, see
+		 * MEMPOOL_PAIRING_HEAP: the first child, the next
+		 * sibling and the previous sibling or the parent.
+		 */
+		struct {
+			struct mslab *child;
+			struct mslab *next;
+			struct mslab *prev;
+		} in_heap;
+	};
 	/** Next slab in stagged slabs list in mempool object */
 	struct rlist next_in_cold;
 	/** Set if this slab is a member of hot_slabs tree */
 	bool in_hot_slabs;
+	/** Offset of the first object, see MEMPOOL_COLORING. */
+	uint32_t offset;
 	/** Pointer to mempool, the owner of this mslab */
 	struct mempool *mempool;
+	/**
+	 * Objects freed by other threads with mempool_free_remote(),
+	 * linked through their first bytes.
+	 */
+	void *remote_free;
+	/** Next slab in mempool::remote_slabs. */
+	struct mslab *next_remote;
 };
 
 /**
@@ -148,6 +169,39 @@ mempool_objsize_max(uint32_t slab_size)
 
 typedef rb_tree(struct mslab) mslab_tree_t;
 
+/** Mempool options, see mempool_set_flags(). */
+enum mempool_flag {
+	/**
+	 * Keep hot slabs in a pairing heap ordered by address
+	 * instead of a red-black tree. Inserting a slab is O(1)
+	 * and there is no rebalancing, removal of a slab is
+	 * O(log n) amortized.
+	 */
+	MEMPOOL_PAIRING_HEAP = 1 << 0,
+	/**
+	 * Shift the objects of each new slab by a cache line
+	 * more than in the previous one, so that objects at the
+	 * same index in different slabs map to different cache
+	 * sets. A few cache lines at the slab start are reserved
+	 * for this.
+	 */
+	MEMPOOL_COLORING = 1 << 1,
+	/**
+	 * Round the object size up to a power of two up to the
+	 * cache line size or to a multiple of the cache line
+	 * size and align objects accordingly, so that no object
+	 * spans more cache lines than its size requires.
+	 */
+	MEMPOOL_NO_STRADDLE = 1 << 2,
+	/**
+	 * Prefetch the object the next allocation will return
+	 * when handing out the current one, so that popping a
+	 * free list whose objects are out of the cache does not
+	 * stall on every allocation.
+	 */
+	MEMPOOL_PREFETCH = 1 << 3,
+};
+
 struct small_mempool;
 
 /** A memory pool. */
@@ -165,7 +219,11 @@ struct mempool
 	 * memory fragmentation across many slabs.
 	 */
 	mslab_tree_t hot_slabs;
-	/** Cached leftmost node of hot_slabs tree. */
+	/**
+	 * Cached leftmost node of hot_slabs tree, or the root
+	 * of the pairing heap of hot slabs if the pool has
+	 * MEMPOOL_PAIRING_HEAP set.
+	 */
 	struct mslab *first_hot_slab;
 	/**
 	 * Slabs with a little of free items count, staged to
@@ -179,6 +237,16 @@ struct mempool
 	 * a single element allocation.
 	 */
 	struct mslab *spare;
+	/**
+	 * Freed objects kept for reuse by mempool_alloc() without
+	 * touching their slabs, linked through their first bytes,
+	 * see mempool_set_magazine_size().
+	 */
+	void *magazine;
+	/** The number of objects in the magazine. */
+	uint32_t magazine_count;
+	/** The magazine capacity, 0 if it is disabled. */
+	uint32_t magazine_size;
 	/**
 	 * The size of an individual object. All objects
 	 * allocated on the pool have the same size.
@@ -197,6 +265,12 @@ struct mempool
 	uint32_t objcount;
 	/** Offset from beginning of slab to the first object */
 	uint32_t offset;
+	/** The difference between offsets of two slab colors. */
+	uint32_t color_step;
+	/** The number of slab colors, 1 if coloring is disabled. */
+	uint32_t color_count;
+	/** The color of the next new slab. */
+	uint32_t color_next;
 	/** Address mask to translate ptr to slab */
 	intptr_t slab_ptr_mask;
 	/**
@@ -205,6 +279,15 @@ struct mempool
 	 * NULL
 	 */
 	struct small_mempool *small_mempool;
+	/** A bitwise OR of enum mempool_flag. */
+	uint32_t flags;
+	/**
+	 * Slabs having objects freed by other threads, linked
+	 * through mslab::next_remote. A slab is added by the
+	 * thread whose free makes its remote_free list non-empty
+	 * and the owner collects all of them at once.
+	 */
+	struct mslab *remote_slabs;
 };
 
 void
@@ -219,12 +302,56 @@ mempool_count(struct mempool *pool)
 	return pool->slabs.stats.used/pool->objsize;
 }
 
-/** @todo: struct mempool_iterator */
+/**
+ * Iterator over objects allocated from a mempool, slab by slab
+ * in no particular order. Free objects are skipped using a
+ * bitmap of the current slab built from its free list. The pool
+ * must not be changed until the iterator is destroyed.
+ */
+struct mempool_iterator {
+	struct mempool *pool;
+	/** The current slab, NULL at the end. */
+	struct mslab *slab;
+	/** Index of the next object to check in the slab. */
+	uint32_t idx;
+	/** Holds the free objects bitmap. */
+	struct slab *map_slab;
+	/** A bit per object of the slab, set if it is free. */
+	uint64_t *map;
+};
+
+/**
+ * Start iterating over the objects of @a pool. Empties the
+ * magazine and collects remote frees first, so the objects
+ * visited are exactly the ones counted by mempool_count().
+ *
+ * @retval 0 success
+ * @retval -1 out of memory for the bitmap
+ */
+int
+mempool_iterator_create(struct mempool_iterator *it, struct mempool *pool);
+
+/** Return the next object or NULL at the end. */
+void *
+mempool_iterator_next(struct mempool_iterator *it);
+
+/** Release the memory held by the iterator. */
+void
+mempool_iterator_destroy(struct mempool_iterator *it);
 
 void
 mempool_create_with_order(struct mempool *pool, struct slab_cache *cache,
 			  uint32_t objsize, uint8_t order);
 
+/**
+ * Set mempool options, a bitwise OR of enum mempool_flag.
+ * MEMPOOL_NO_STRADDLE changes the object size reported by
+ * the pool, so the flags are meant to be set once.
+ * @pre no objects have been allocated from the pool yet
+ */
+void
+mempool_set_flags(struct mempool *pool, uint32_t flags);
+
 /**
  * Initialize a mempool. Tell the pool the size of objects
  * it will contain.
@@ -278,9 +405,85 @@ mempool_destroy(struct mempool *pool);
 void *
 mempool_alloc(struct mempool *pool);
 
+/**
+ * Allocate up to @a count objects at once. Objects are taken
+ * from the magazine first, then each slab gives out as many
+ * objects as it has in one pass, so the hot slabs tree is
+ * updated at most once per slab.
+ *
+ * @return the number of objects stored in @a objs, less than
+ *         @a count on memory exhaustion
+ */
+uint32_t
+mempool_alloc_batch(struct mempool *pool, void **objs, uint32_t count);
+
+/**
+ * Free @a count objects at once. Runs of objects from the same
+ * slab are returned to it together, so the slab lists and the
+ * hot slabs tree are updated once per run rather than once per
+ * object; sort the objects by address to make runs longest.
+ * The magazine is bypassed.
+ */
+void
+mempool_free_batch(struct mempool *pool, void **objs, uint32_t count);
+
+/**
+ * Keep up to @a size freed objects in a magazine and hand them
+ * out again before allocating from the slabs. When the magazine
+ * is full, half of it is returned to the slabs at once. Objects
+ * in the magazine are not counted as used, but they keep their
+ * slabs from being released. 0 (the default) disables the
+ * magazine and returns all its objects to the slabs.
+ */
+void
+mempool_set_magazine_size(struct mempool *pool, uint32_t size);
+
 void
 mslab_free(struct mempool *pool, struct mslab *slab, void *ptr);
 
+/**
+ * Free an object from a thread other than the pool owner.
+ * The object is pushed to a lock-free list of its slab and is
+ * returned to the slab by the owner on its next allocation or
+ * mempool_collect_remote() call. Until then it is counted as
+ * used.
+ */
+void
+mempool_free_remote(struct mempool *pool, void *ptr);
+
+/** Return objects freed with mempool_free_remote() to their slabs. */
+void
+mempool_collect_remote(struct mempool *pool);
+
+/**
+ * Relocate an object for mempool_defrag(): copy it from @a old_obj
+ * to @a new_obj and update all references to it.
+ *
+ * @retval true the object has moved, @a old_obj is freed
+ * @retval false the object is pinned, @a new_obj is freed
+ */
+typedef bool
+(*mempool_move_cb)(void *old_obj, void *new_obj, void *arg);
+
+/**
+ * Release sparsely used slabs by moving their objects to denser
+ * ones. Slabs are evacuated starting from the one with the
+ * fewest used objects, as long as the denser slabs have room for
+ * all of its objects. A slab with an object @a move_cb refuses
+ * to move is left as is. Empties the magazine and collects
+ * remote frees first.
+ *
+ * @param budget the maximal number of objects to move
+ * @return the number of objects moved
+ */
+size_t
+mempool_defrag(struct mempool *pool, size_t budget,
+	       mempool_move_cb move_cb, void *arg);
+
+/** Put a freed object to the magazine, see mempool_set_magazine_size(). */
+void
+mempool_magazine_put(struct mempool *pool, void *ptr);
+
 /**
  * Helper function for quick free up memory. In case we know
  * slab we don't need to find it from ptr. Used in case when
@@ -297,7 +500,10 @@ mempool_free_slab(struct mempool *pool, struct mslab *slab, void *ptr)
 #endif
 	assert(slab->slab.order == pool->slab_order);
 	pool->slabs.stats.used -= pool->objsize;
-	mslab_free(pool, slab, ptr);
+	if (pool->magazine_size > 0)
+		mempool_magazine_put(pool, ptr);
+	else
+		mslab_free(pool, slab, ptr);
 }
 
 /**
@@ -63,7 +63,37 @@ enum {
 	SLAB_ARENA_SHARED	= SLAB_ARENA_FLAG(1 << 1),
 
 	/* madvise() flags */
-	SLAB_ARENA_DONTDUMP	= SLAB_ARENA_FLAG(1 << 2)
+	SLAB_ARENA_DONTDUMP	= SLAB_ARENA_FLAG(1 << 2),
+
+	/*
+	 * Huge page backing. SLAB_ARENA_HUGETLB maps memory from
+	 * the hugetlb pool (MAP_HUGETLB) and is only honored if
+	 * the slab size is a multiple of the default huge page
+	 * size. SLAB_ARENA_THP asks the kernel to back regular
+	 * mappings with transparent huge pages (MADV_HUGEPAGE).
+	 * If the hugetlb pool is exhausted, the arena silently
+	 * falls back to regular pages, see slab_arena::flags.
+	 */
+	SLAB_ARENA_HUGETLB	= SLAB_ARENA_FLAG(1 << 3),
+	SLAB_ARENA_THP		= SLAB_ARENA_FLAG(1 << 4),
+
+	/*
+	 * NUMA awareness: fresh slabs are bound to the node of
+	 * the calling thread and freed slabs are cached per node,
+	 * see struct slab_arena_node. Cleared at arena creation
+	 * if the kernel has no NUMA support.
+	 */
+	SLAB_ARENA_NUMA		= SLAB_ARENA_FLAG(1 << 5),
+
+	/*
+	 * Lazy reservation: the preallocated area is only
+	 * reserved as inaccessible address space and committed
+	 * (made accessible) on demand as slabs are mapped, see
+	 * slab_arena::committed. Allows to reserve a large
+	 * contiguous area without paying for it up front.
+	 * Excludes SLAB_ARENA_HUGETLB.
+	 */
+	SLAB_ARENA_RESERVE	= SLAB_ARENA_FLAG(1 << 6)
 };
 
 #include "small_config.h"
@@ -75,17 +105,96 @@ enum {
 #ifndef ENABLE_ASAN
 
 #include "lf_lifo.h"
+#include "util.h"
 
 #if defined(__cplusplus)
 extern "C" {
 #endif /* defined(__cplusplus) */
 
+enum {
+	/** The largest number of slabs moved by slab_(un)map_batch(). */
+	SLAB_BATCH_MAX = 32,
+	/** The largest capacity of a slab magazine. */
+	SLAB_MAGAZINE_SIZE_MAX = 2 * SLAB_BATCH_MAX,
+	/** How many slabs are committed at once in SLAB_ARENA_RESERVE mode. */
+	SLAB_ARENA_COMMIT_CHUNK = 16,
+	/**
+	 * How many NUMA nodes an arena distinguishes. Slabs of
+	 * nodes with greater ids share caches modulo this value.
+	 */
+	SLAB_ARENA_NODE_MAX = 8
+};
+
+/**
+ * Per NUMA node state of an arena in SLAB_ARENA_NUMA mode.
+ * Occupies a cache line of its own to not bounce it between
+ * sockets.
+ */
+struct slab_arena_node {
+	/** A lock free list of cached slabs residing on the node. */
+	struct lf_lifo cache;
+	/** Cached batches of slabs residing on the node. */
+	struct lf_lifo depot;
+	/**
+	 * How much memory has been bound to the node and
+	 * not returned to the operating system.
+	 */
+	size_t used;
+	/**
+	 * How many slabs threads of this node have taken from
+	 * caches of other nodes because the quota was exhausted.
+	 */
+	size_t steals;
+} __attribute__((aligned(SMALL_CACHELINE_SIZE)));
+
+struct slab_arena_prefaulter;
+struct slab_arena_file_header;
+
+/**
+ * Event counters of an arena. Updated atomically, never
+ * decrease. Are kept on a separate cache line not to slow
+ * down the hot arena fields.
+ */
+struct slab_arena_counters {
+	/** Slabs served from the arena caches. */
+	size_t cache_hits;
+	/** Slabs which memory was obtained anew: never used or trimmed. */
+	size_t fresh_maps;
+	/** Fresh slabs refused because the quota is exhausted. */
+	size_t quota_refusals;
+	/** Fresh preallocated slabs mapped pre-faulted. */
+	size_t prefault_hits;
+	/** Fresh preallocated slabs mapped cold. */
+	size_t prefault_misses;
+	/** mmap(), munmap(), madvise() and mprotect() calls. */
+	size_t mmaps;
+	size_t munmaps;
+	size_t madvises;
+	size_t mprotects;
+	/** The largest value slab_arena::used has had. */
+	size_t peak_used;
+} __attribute__((aligned(SMALL_CACHELINE_SIZE)));
+
+/** A snapshot of arena statistics, see slab_arena_stats(). */
+struct slab_arena_stats {
+	struct slab_arena_counters counters;
+	/** slab_arena::used. */
+	size_t used;
+	/** slab_arena::cached. */
+	size_t cached;
+	/** slab_arena::committed. */
+	size_t committed;
+	/** slab_arena::prealloc. */
+	size_t prealloc;
+};
+
 /**
  * slab_arena -- a source of large aligned blocks of memory.
  * MT-safe.
  * Uses a lock-free LIFO to maintain a cache of used slabs.
  * Uses a lock-free quota to limit allocating memory.
- * Never returns memory to the operating system.
+ * Never returns memory to the operating system unless
+ * explicitly asked to with slab_arena_trim().
  */
 struct slab_arena {
 	/**
@@ -95,6 +204,20 @@ struct slab_arena {
 	 * used to recycle them.
 	 */
 	struct lf_lifo cache;
+	/**
+	 * A lock free list of cached batches of slabs, see
+	 * slab_unmap_batch(). Each batch is pushed and popped
+	 * with a single atomic operation.
+	 */
+	struct lf_lifo depot;
+	/**
+	 * A lock free list of slabs which memory has been
+	 * returned to the operating system by slab_arena_trim().
+	 * Their quota is released, the address space is kept.
+	 */
+	struct lf_lifo trimmed;
+	/** How much memory is kept in the slab cache(s). */
+	size_t cached;
 	/** A preallocated arena of size = prealloc. */
 	void *arena;
 	/**
@@ -107,6 +230,25 @@ struct slab_arena {
 	 * already been initialized for slabs.
 	 */
 	size_t used;
+	/**
+	 * How much memory in the preallocated area is accessible.
+	 * Equals prealloc unless SLAB_ARENA_RESERVE is set, then
+	 * grows in chunks of SLAB_ARENA_COMMIT_CHUNK slabs.
+	 */
+	size_t committed;
+	/**
+	 * How much memory in the preallocated area has been
+	 * pre-faulted, see slab_arena_prefault(). Grows
+	 * monotonically and never exceeds prealloc.
+	 */
+	size_t prefaulted;
+	/** The pre-faulting thread or NULL, see slab_arena_prefault_start(). */
+	struct slab_arena_prefaulter *prefaulter;
+	/**
+	 * Header of the backing file, NULL unless the arena has
+	 * been created by slab_arena_create_file().
+	 */
+	struct slab_arena_file_header *header;
 	/**
 	 * An external quota to which we must adhere.
 	 * A quota exists to set a common limit on two arenas.
@@ -128,10 +270,27 @@ struct slab_arena {
 	 * allocate objects of size up to ~1MB.
 	 */
 	uint32_t slab_size;
+	/**
+	 * Per node caches and counters, used instead of
+	 * the cache above in SLAB_ARENA_NUMA mode.
+	 */
+	struct slab_arena_node nodes[SLAB_ARENA_NODE_MAX];
+	/**
+	 * NUMA node of each slab of the preallocated area, modulo
+	 * SLAB_ARENA_NODE_MAX, recorded when a slab is mapped anew
+	 * so that slab_unmap() needn't ask the kernel. NULL unless
+	 * in SLAB_ARENA_NUMA mode.
+	 */
+	uint8_t *slab_nodes;
 	/**
 	 * SLAB_ARENA_ flags for mmap() and madvise() calls.
+	 * SLAB_ARENA_HUGETLB is cleared as soon as a hugetlb
+	 * mapping fails, so it shows whether the memory is
+	 * still being backed by huge pages.
 	 */
 	int flags;
+	/** Event counters, see slab_arena_stats(). */
+	struct slab_arena_counters counters;
 };
 
 /** Initialize an arena.  */
@@ -139,7 +298,52 @@ int
 slab_arena_create(struct slab_arena *arena, struct quota *quota,
 		  size_t prealloc, uint32_t slab_size, int flags);
 
-/** Destroy an arena. */
+/**
+ * Initialize an arena backed by a file (or a memfd), so that
+ * its slabs survive a process restart.
+ *
+ * The file starts with a header page recording slab_size,
+ * prealloc, arena->used, the address of the slabs and the
+ * heads of the free lists, the slabs follow it. If the file
+ * has no header yet, it is extended to fit @a prealloc bytes
+ * of slabs and initialized. Otherwise the slabs are mapped
+ * back at the recorded address (so pointers stored in them
+ * stay valid), the arena state saved by the last
+ * slab_arena_sync() is restored and the quota is charged for
+ * the slabs in use; @a prealloc is ignored then.
+ *
+ * The arena is limited to the preallocated area. The mapping
+ * is always shared, SLAB_ARENA_NUMA and SLAB_ARENA_HUGETLB
+ * are ignored.
+ *
+ * @retval 0 success
+ * @retval -1 error, errno is set: EINVAL if the header does
+ *         not match @a slab_size or the file is truncated or
+ *         corrupted, EADDRNOTAVAIL if the slabs
+ *         can not be mapped back at the recorded address,
+ *         ENOMEM if the quota is exceeded
+ */
+int
+slab_arena_create_file(struct slab_arena *arena, struct quota *quota,
+		       int fd, size_t prealloc, uint32_t slab_size,
+		       int flags);
+
+/**
+ * Save the state of a file backed arena into the file header
+ * and flush the slabs and the header to the file. The state
+ * is consistent only if no slabs are being mapped or unmapped
+ * concurrently. Slabs kept in magazines are saved as in use.
+ *
+ * @retval 0 success
+ * @retval -1 msync() error, errno is set
+ */
+int
+slab_arena_sync(struct slab_arena *arena);
+
+/**
+ * Destroy an arena. A file backed arena is synced and
+ * unmapped, its slabs need not be returned beforehand.
+ */
 void
 slab_arena_destroy(struct slab_arena *arena);
 
@@ -151,7 +355,131 @@ slab_map(struct slab_arena *arena);
 void
 slab_unmap(struct slab_arena *arena, void *ptr);
 
-/** mprotect() the preallocated arena. */
+/**
+ * Get up to @a count slabs, touching the shared cache once
+ * in the common case.
+ * @pre count <= SLAB_BATCH_MAX
+ * @return the number of slabs stored in @a slabs,
+ *         0 if out of memory.
+ */
+unsigned
+slab_map_batch(struct slab_arena *arena, void **slabs, unsigned count);
+
+/**
+ * Put @a count slabs into the cache as a single batch.
+ * @pre count <= SLAB_BATCH_MAX
+ */
+void
+slab_unmap_batch(struct slab_arena *arena, void **slabs, unsigned count);
+
+/**
+ * slab_magazine -- a bounded per-thread stack of slabs in
+ * front of a slab_arena. Absorbs map/unmap oscillations
+ * without touching the arena and exchanges slabs with it in
+ * batches of size / 2, so the shared lock-free cache is
+ * accessed once per batch rather than once per slab.
+ * Not MT-safe: each thread must use a magazine of its own.
+ */
+struct slab_magazine {
+	/** The arena to exchange slabs with. */
+	struct slab_arena *arena;
+	/** The largest number of slabs kept in the magazine. */
+	unsigned size;
+	/** The number of slabs kept in the magazine. */
+	unsigned count;
+	/** The slabs, the most recently unmapped one on top. */
+	void *slabs[SLAB_MAGAZINE_SIZE_MAX];
+};
+
+/**
+ * Initialize a magazine of the given capacity.
+ * @pre 2 <= size <= SLAB_MAGAZINE_SIZE_MAX
+ */
+void
+slab_magazine_create(struct slab_magazine *mag, struct slab_arena *arena,
+		     unsigned size);
+
+/** Return all slabs kept in the magazine to the arena. */
+void
+slab_magazine_flush(struct slab_magazine *mag);
+
+/** Destroy a magazine, returning all its slabs to the arena. */
+static inline void
+slab_magazine_destroy(struct slab_magazine *mag)
+{
+	slab_magazine_flush(mag);
+}
+
+/** Get a slab, refilling the magazine from the arena if needed. */
+void *
+slab_magazine_map(struct slab_magazine *mag);
+
+/** Put a slab into the magazine, flushing it to the arena if full. */
+void
+slab_magazine_unmap(struct slab_magazine *mag, void *ptr);
+
+/**
+ * Return memory of cached slabs exceeding @a keep bytes to
+ * the operating system and release their quota. The slabs
+ * stay reserved in the arena address space and are reused
+ * by slab_map() when the cache is empty. May be called from
+ * any thread.
+ *
+ * @return the amount of released memory.
+ */
+size_t
+slab_arena_trim(struct slab_arena *arena, size_t keep);
+
+/**
+ * Same as slab_arena_trim(), but releases at most @a max
+ * bytes per call, so that a background fiber or thread can
+ * shrink the arena in small steps without long stalls.
+ */
+size_t
+slab_arena_trim_step(struct slab_arena *arena, size_t keep, size_t max);
+
+/**
+ * Pre-fault up to @a count never used slabs of the
+ * preallocated area following arena->used, so that the
+ * first touch of these slabs after slab_map() does not page
+ * fault. The slabs contents is not changed, so it is safe
+ * to call it concurrently with slab_map().
+ *
+ * @return the number of pre-faulted slabs.
+ */
+size_t
+slab_arena_prefault(struct slab_arena *arena, size_t count);
+
+/**
+ * Start a thread keeping @a ahead slabs following
+ * arena->used pre-faulted. slab_map() wakes it up when the
+ * pre-faulted margin halves. Slabs mmap()ed beyond the
+ * preallocated area are not pre-faulted. In SLAB_ARENA_NUMA
+ * mode slabs are bound to the node of the calling thread
+ * before they are touched.
+ *
+ * @retval 0 success
+ * @retval -1 out of memory or failed to start a thread
+ */
+int
+slab_arena_prefault_start(struct slab_arena *arena, size_t ahead);
+
+/**
+ * Stop the pre-faulting thread, if any. Must not be called
+ * concurrently with slab_map(). Called by slab_arena_destroy().
+ */
+void
+slab_arena_prefault_stop(struct slab_arena *arena);
+
+/**
+ * Take a snapshot of arena statistics. Cheap and lock-free,
+ * may be called from any thread. The fields are read one by
+ * one, so a snapshot taken under load is not exactly coherent.
+ */
+void
+slab_arena_stats(struct slab_arena *arena, struct slab_arena_stats *stats);
+
+/** mprotect() the used part of the preallocated arena. */
 void
 slab_arena_mprotect(struct slab_arena *arena);
 
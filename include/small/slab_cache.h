@@ -91,7 +91,11 @@ struct slab {
  * A binary logarithmic distance between the smallest and
  * the largest slab in the cache can't be that big, really.
  */
-enum { ORDER_MAX = 16 };
+enum {
+	ORDER_MAX = 16,
+	/** Number of power of two size bins of cached large slabs. */
+	SLAB_LARGE_BIN_COUNT = sizeof(size_t) * CHAR_BIT,
+};
 
 struct slab_cache {
 	/* The source of allocations for this cache. */
@@ -132,6 +136,41 @@ struct slab_cache {
 	 * next_in_list link may be reused for some other purpose.
 	 */
 	struct slab_list orders[ORDER_MAX+1];
+	/**
+	 * If set, slabs are exchanged with the arena through
+	 * this magazine, see slab_cache_set_magazine().
+	 */
+	struct slab_magazine *magazine;
+	/**
+	 * The lowest number of free slabs of order_max since
+	 * the last slab_cache_gc(): that many slabs have been
+	 * idle for the whole period.
+	 */
+	size_t gc_idle;
+	/**
+	 * Slabs put by other threads with slab_put_remote(),
+	 * linked through slab->next_in_list.next. Drained by
+	 * the owner thread in slab_get() and slab_put().
+	 */
+	struct slab *remote;
+	/**
+	 * Large slabs released by slab_put_large() and kept for
+	 * reuse, linked through next_in_list into bins by the
+	 * binary logarithm of their size and through
+	 * next_in_cache into an LRU list, the most recently
+	 * released first.
+	 */
+	struct rlist large_bins[SLAB_LARGE_BIN_COUNT];
+	struct rlist large_lru;
+	/** Total size of cached large slabs. */
+	size_t large_cached;
+	/** The limit of large_cached, 0 disables the cache. */
+	size_t large_cached_max;
+	/**
+	 * The lowest value of large_cached since the last
+	 * slab_cache_gc(), like gc_idle for ordered slabs.
+	 */
+	size_t large_idle;
 #ifndef NDEBUG
 	pthread_t thread_id;
 #endif
@@ -143,6 +182,33 @@ slab_cache_create(struct slab_cache *cache, struct slab_arena *arena);
 void
 slab_cache_destroy(struct slab_cache *cache);
 
+/**
+ * Keep up to @a max bytes of large slabs released by
+ * slab_put_large() for reuse by slab_get_large(), evicting
+ * the least recently released ones beyond the limit. A cached
+ * slab is reused for requests between half its size and its
+ * size, and keeps its quota. If the quota is exhausted, the
+ * cache is flushed before an allocation fails. 0 (the default)
+ * disables the cache.
+ */
+void
+slab_cache_set_large_cache_size(struct slab_cache *cache, size_t max);
+
+/**
+ * Make the cache map and unmap arena slabs through a
+ * magazine, which is cheaper when many threads share the
+ * arena. The magazine must be created on the cache arena,
+ * be used by the cache thread only and outlive the cache.
+ * Pass NULL to go to the arena directly.
+ */
+static inline void
+slab_cache_set_magazine(struct slab_cache *cache,
+			struct slab_magazine *magazine)
+{
+	assert(magazine == NULL || magazine->arena == cache->arena);
+	cache->magazine = magazine;
+}
+
 /**
  * Allocate ordered slab
  * @see slab_order()
@@ -156,6 +222,29 @@ slab_get_with_order(struct slab_cache *cache, uint8_t order);
 void
 slab_put_with_order(struct slab_cache *cache, struct slab *slab);
 
+/**
+ * Allocate up to @a count ordered slabs at once. Free slabs of
+ * the order are taken first, then bigger slabs are cut into
+ * slabs of the order in one pass rather than split in halves
+ * one slab at a time.
+ *
+ * @return the number of slabs stored in @a slabs, less than
+ *         @a count on memory or quota exhaustion
+ */
+size_t
+slab_get_batch(struct slab_cache *cache, uint8_t order, size_t count,
+	       struct slab **slabs);
+
+/**
+ * Deallocate @a count slabs, ordered or large. Ordered slabs
+ * are merged with their buddies one by one, as with
+ * slab_put_with_order(), and only the statistics are updated
+ * once for the whole batch, so this costs about the same as
+ * @a count single puts.
+ */
+void
+slab_put_batch(struct slab_cache *cache, struct slab **slabs, size_t count);
+
 /**
  * Allocate large slab.
  * @pre size > slab_order_size(cache->arena->slab_size)
@@ -170,6 +259,24 @@ slab_get_large(struct slab_cache *slab, size_t size);
 void
 slab_put_large(struct slab_cache *cache, struct slab *slab);
 
+/**
+ * Grow a large slab to hold @a size bytes of data, keeping
+ * only the @a len bytes of data at @a offset, which are moved
+ * to the beginning of the slab data. Large slabs of a megabyte
+ * and bigger have a mapping of their own and are grown with
+ * mremap(), so their pages are never copied. Smaller ones get
+ * the live data copied into a new large slab.
+ *
+ * @pre slab was allocated with slab_get_large()
+ * @pre offset + len <= slab_capacity(slab)
+ * @retval NULL on quota or memory exhaustion, the slab is
+ *         left intact
+ * @return the grown slab
+ */
+struct slab *
+slab_grow_large(struct slab_cache *cache, struct slab *slab, size_t size,
+		size_t offset, size_t len);
+
 /**
  * A shortcut for slab_get_with_order()/slab_get_large()
  * @see slab_get_with_order()
@@ -186,6 +293,32 @@ slab_get(struct slab_cache *cache, size_t size);
 void
 slab_put(struct slab_cache *cache, struct slab *slab);
 
+/**
+ * Return slabs of order_max which have stayed free since the
+ * previous call to the arena and free cached large slabs that
+ * have not been reused since then, at most @a budget bytes.
+ * Is meant to be called periodically, like once a second, so
+ * that the memory kept by an idle cache decays. No slabs are
+ * split or merged; free slabs of lower orders can not be
+ * returned until they merge with their buddies.
+ *
+ * @return the number of bytes released.
+ */
+size_t
+slab_cache_gc(struct slab_cache *cache, size_t budget);
+
+/**
+ * Return a slab to the cache from a thread other than the
+ * cache owner. The slab is pushed to a lock-free inbox and
+ * actually freed by the owner on its next slab_get(),
+ * slab_put() or slab_cache_destroy(). Until then it is
+ * accounted as used. The slab must not be accessed after
+ * the call.
+ * @remark This function is thread-safe.
+ */
+void
+slab_put_remote(struct slab_cache *cache, struct slab *slab);
+
 /**
  * Return the number of bytes used by this slab cache.
  * @remark This function is thread-safe.
@@ -213,6 +346,47 @@ slab_from_ptr(void *ptr, intptr_t slab_mask)
 void
 slab_cache_check(struct slab_cache *cache);
 
+/** Fragmentation of a slab cache, see slab_cache_fragmentation(). */
+struct slab_cache_fragmentation {
+	/** The number of arena slabs split into smaller slabs. */
+	size_t split;
+	/**
+	 * Free memory in split arena slabs. It can not be
+	 * returned to the arena until all slabs of the arena slab
+	 * are freed and merged back.
+	 */
+	size_t stranded;
+	struct {
+		/** Split arena slabs having free slabs of the order. */
+		size_t split;
+		/** Free memory in slabs of the order. */
+		size_t stranded;
+	} orders[ORDER_MAX + 1];
+};
+
+/**
+ * Called by slab_cache_fragmentation() for every slab in use
+ * that pins a split arena slab, with the free memory of that
+ * arena slab. The callback may move the slab contents away
+ * or release it later, but must not get or put slabs of this
+ * cache while the walk is in progress.
+ */
+typedef void
+(*slab_pin_cb)(struct slab *slab, size_t stranded, void *arg);
+
+/**
+ * Walk the arena slabs of the cache, fill @a frag and, unless
+ * @a cb is NULL, call it for the slabs pinning split arena
+ * slabs. The sparsest arena slabs are the best candidates
+ * for compaction.
+ *
+ * Free slabs of order_max and large slabs are not counted.
+ */
+void
+slab_cache_fragmentation(struct slab_cache *cache,
+			 struct slab_cache_fragmentation *frag,
+			 slab_pin_cb cb, void *arg);
+
 /**
  * Find the nearest power of 2 size capable of containing
  * a chunk of the given size. Adjust for cache->order0_size
@@ -127,8 +127,30 @@ struct small_mempool {
 	 * will be: 64 bytes - 32 bytes = 32 bytes.
 	 */
 	size_t waste;
+	/**
+	 * Freed objects of this size class kept for reuse by
+	 * smalloc(), linked through their first bytes, see
+	 * small_alloc_set_tcache_size().
+	 */
+	void *tcache;
+	/** The number of objects in the tcache. */
+	uint32_t tcache_count;
 };
 
+/**
+ * A large object allocated from slab_cache rather than from a
+ * mempool. Placed at the end of the object slab and kept in a
+ * tree, so that smfree_nosize() can tell large objects from
+ * small ones. Only maintained if smfree_nosize() is enabled.
+ */
+struct small_large {
+	rb_node(struct small_large) node;
+	/** The slab holding the object. */
+	struct slab *slab;
+};
+
+typedef rb_tree(struct small_large) small_large_tree_t;
+
 struct small_mempool_group {
 	/** The first pool in the group. */
 	struct small_mempool *first;
@@ -171,6 +193,18 @@ struct small_alloc {
 	/** Small class for this allocator */
 	struct small_class small_class;
 	uint32_t objsize_max;
+	/** The tcache capacity per size class, 0 if it is disabled. */
+	uint32_t tcache_size;
+	/**
+	 * True if objects may be freed with smfree_nosize(), see
+	 * small_alloc_enable_nosize().
+	 */
+	bool nosize;
+	/**
+	 * Large objects ordered by address of their slabs, empty
+	 * unless nosize is set.
+	 */
+	small_large_tree_t large;
 };
 
 /**
@@ -207,10 +241,50 @@ smalloc(struct small_alloc *alloc, size_t size);
  *
  * This boils down to finding the object's mempool and delegating
  * to mempool_free().
+ *
+ * @a size must be the size the object was allocated with. For a
+ * large object, i.e. one bigger than objsize_max, any size
+ * bigger than objsize_max will do.
  */
 void
 smfree(struct small_alloc *alloc, void *ptr, size_t size);
 
+/**
+ * Allow objects to be freed with smfree_nosize(). Large objects
+ * are kept in a tree from now on, which costs an insertion and
+ * a removal per large object. Every size class allocates from
+ * its own mempool then, so that no waste is accounted to it.
+ *
+ * @pre nothing has been allocated yet
+ */
+void
+small_alloc_enable_nosize(struct small_alloc *alloc);
+
+/**
+ * Free a small object without knowing its size.
+ *
+ * Large objects are looked up in the tree of large objects,
+ * the slab of a small one is found by its address alone. The
+ * object is credited to the class of its mempool, which is the
+ * class it was requested from.
+ *
+ * @pre small_alloc_enable_nosize() has been called
+ */
+void
+smfree_nosize(struct small_alloc *alloc, void *ptr);
+
+/**
+ * Keep up to @a size freed objects of each size class in a
+ * cache in front of the mempools. smalloc() takes objects from
+ * the cache of the requested size class, refilling an empty one
+ * with a batch of objects, and smfree() puts them back, flushing
+ * half of the cache to the mempools when it is full. Objects in
+ * the caches are counted as used. 0 (the default) disables the
+ * caches and flushes all objects in them.
+ */
+void
+small_alloc_set_tcache_size(struct small_alloc *alloc, uint32_t size);
+
 void
 small_stats(struct small_alloc *alloc,
 	    struct small_stats *totals,
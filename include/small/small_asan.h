@@ -105,6 +105,16 @@ smalloc(struct small_alloc *alloc, size_t size);
 void
 smfree(struct small_alloc *alloc, void *ptr, size_t size);
 
+static inline void
+small_alloc_enable_nosize(struct small_alloc *alloc)
+{
+	(void)alloc;
+}
+
+/** Free memory chunk allocated by the small allocator of any size. */
+void
+smfree_nosize(struct small_alloc *alloc, void *ptr);
+
 void
 small_stats(struct small_alloc *alloc,
 	    struct small_stats *totals,
@@ -43,6 +43,13 @@ extern "C" {
 enum {
 	/* To check if SLAB_ARENA_DONTDUMP is supported */
 	SMALL_FEATURE_DONTDUMP		= 0,
+	/*
+	 * To check if SLAB_ARENA_HUGETLB can actually obtain
+	 * pages from the hugetlb pool.
+	 */
+	SMALL_FEATURE_HUGETLB		= 1,
+	/* To check if SLAB_ARENA_THP is supported */
+	SMALL_FEATURE_THP		= 2,
 
 	FEATURE_MAX
 };
@@ -84,6 +84,9 @@
 #  define static_assert _Static_assert
 #endif
 
+/** Assumed size of a CPU cache line. */
+#define SMALL_CACHELINE_SIZE 64
+
 #ifndef lengthof
 #  define lengthof(array) (sizeof (array) / sizeof ((array)[0]))
 #endif
@@ -116,6 +119,13 @@ small_getpagesize(void)
 	return page_size;
 }
 
+/**
+ * Return size of the default huge page in bytes or 0 if huge
+ * pages are not supported by the system.
+ */
+size_t
+small_gethugepagesize(void);
+
 /**
  * Align a size - round up to nearest divisible by the given alignment.
  * Alignment must be a power of 2
@@ -0,0 +1,252 @@
+/*
+ * Copyright 2010-2021, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include "mempool.h"
+#include "quota.h"
+
+#include <utility>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+enum {
+	/** Arena slab size. */
+	SLAB_SIZE = 4194304,
+};
+
+static struct quota quota;
+static struct slab_arena arena;
+static struct slab_cache cache;
+static struct mempool pool;
+
+/**
+ * Create the pool with slabs of the default size or, if
+ * @a large_slabs is set, of the arena slab size.
+ */
+static void
+mempool_test_start(uint32_t objsize, uint32_t flags, bool large_slabs = false)
+{
+	quota_init(&quota, UINT_MAX);
+	slab_arena_create(&arena, &quota, 0, SLAB_SIZE, MAP_PRIVATE);
+	slab_cache_create(&cache, &arena);
+	if (large_slabs)
+		mempool_create_with_order(&pool, &cache, objsize,
+					  cache.order_max);
+	else
+		mempool_create(&pool, &cache, objsize);
+	mempool_set_flags(&pool, flags);
+}
+
+static void
+mempool_test_finish(void)
+{
+	mempool_destroy(&pool);
+	slab_cache_destroy(&cache);
+	slab_arena_destroy(&arena);
+}
+
+/**
+ * Keep a number of live objects, replacing a random one on
+ * each iteration, so that objects are freed all over many
+ * slabs and slabs move in and out of the hot slabs. Reports
+ * the share of the pool memory in use at the end.
+ */
+static void
+mempool_random_workload(benchmark::State& state)
+{
+	uint32_t objsize = state.range(0);
+	size_t live = state.range(1);
+	uint32_t flags = state.range(2);
+	mempool_test_start(objsize, flags);
+	std::vector<void *> objs(live);
+	for (auto &obj : objs) {
+		obj = mempool_alloc(&pool);
+		if (obj == NULL) {
+			state.SkipWithError("Failed to allocate memory");
+			return;
+		}
+	}
+	for (auto _ : state) {
+		size_t i = rand() % live;
+		mempool_free(&pool, objs[i]);
+		objs[i] = mempool_alloc(&pool);
+		if (objs[i] == NULL) {
+			state.SkipWithError("Failed to allocate memory");
+			break;
+		}
+	}
+	state.SetItemsProcessed(state.iterations());
+	state.counters["utilization"] =
+		(double)mempool_used(&pool) / mempool_total(&pool);
+	for (auto obj : objs) {
+		if (obj != NULL)
+			mempool_free(&pool, obj);
+	}
+	mempool_test_finish();
+}
+
+BENCHMARK(mempool_random_workload)
+	->Args({64, 1 << 20, 0})
+	->Args({64, 1 << 20, MEMPOOL_PAIRING_HEAP})
+	->Args({1024, 1 << 17, 0})
+	->Args({1024, 1 << 17, MEMPOOL_PAIRING_HEAP})
+	->ArgNames({"objsize", "live", "flags"});
+
+/**
+ * Read the first object of each of many slabs over and over.
+ * Without coloring all of them map to the same cache sets.
+ */
+static void
+mempool_same_index(benchmark::State& state)
+{
+	uint32_t objsize = state.range(0);
+	size_t slabs = state.range(1);
+	uint32_t flags = state.range(2);
+	mempool_test_start(objsize, flags);
+	std::vector<void *> objs(slabs * pool.objcount);
+	std::vector<uint64_t *> first(slabs);
+	for (size_t i = 0; i < objs.size(); i++) {
+		objs[i] = mempool_alloc(&pool);
+		if (objs[i] == NULL) {
+			state.SkipWithError("Failed to allocate memory");
+			return;
+		}
+		if (i % pool.objcount == 0)
+			first[i / pool.objcount] = (uint64_t *)objs[i];
+	}
+	uint64_t sum = 0;
+	for (auto _ : state) {
+		for (auto obj : first)
+			sum += *obj;
+		benchmark::DoNotOptimize(sum);
+	}
+	state.SetItemsProcessed(state.iterations() * slabs);
+	for (auto obj : objs)
+		mempool_free(&pool, obj);
+	mempool_test_finish();
+}
+
+BENCHMARK(mempool_same_index)
+	->Args({256, 64, 0})
+	->Args({256, 64, MEMPOOL_COLORING})
+	->ArgNames({"objsize", "slabs", "flags"});
+
+/**
+ * Read whole objects at random, counting the cache lines
+ * objects span on the way.
+ */
+static void
+mempool_random_read(benchmark::State& state)
+{
+	uint32_t objsize = state.range(0);
+	size_t live = state.range(1);
+	uint32_t flags = state.range(2);
+	mempool_test_start(objsize, flags);
+	std::vector<void *> objs(live);
+	size_t lines = 0;
+	for (auto &obj : objs) {
+		obj = mempool_alloc(&pool);
+		if (obj == NULL) {
+			state.SkipWithError("Failed to allocate memory");
+			return;
+		}
+		uintptr_t addr = (uintptr_t)obj;
+		lines += (addr + objsize - 1) / 64 - addr / 64 + 1;
+	}
+	uint64_t sum = 0;
+	for (auto _ : state) {
+		uint64_t *obj = (uint64_t *)objs[rand() % live];
+		for (uint32_t i = 0; i < objsize / sizeof(*obj); i++)
+			sum += obj[i];
+		benchmark::DoNotOptimize(sum);
+	}
+	state.SetItemsProcessed(state.iterations());
+	state.counters["lines_per_object"] = (double)lines / live;
+	for (auto obj : objs)
+		mempool_free(&pool, obj);
+	mempool_test_finish();
+}
+
+BENCHMARK(mempool_random_read)
+	->Args({48, 1 << 21, 0})
+	->Args({48, 1 << 21, MEMPOOL_NO_STRADDLE})
+	->ArgNames({"objsize", "live", "flags"});
+
+/**
+ * Allocate and initialize objects from free lists shuffled over
+ * slabs much larger than the cache, so that each free list pop
+ * touches a cold cache line.
+ */
+static void
+mempool_cold_alloc(benchmark::State& state)
+{
+	uint32_t objsize = state.range(0);
+	size_t count = state.range(1);
+	uint32_t flags = state.range(2);
+	mempool_test_start(objsize, flags, true);
+	std::vector<void *> objs(count);
+	size_t allocated = count;
+	for (auto _ : state) {
+		if (allocated == count) {
+			state.PauseTiming();
+			for (auto &obj : objs) {
+				if (obj != NULL)
+					mempool_free(&pool, obj);
+				obj = mempool_alloc(&pool);
+			}
+			for (size_t i = count - 1; i > 0; i--)
+				std::swap(objs[i], objs[rand() % (i + 1)]);
+			for (auto obj : objs)
+				mempool_free(&pool, obj);
+			allocated = 0;
+			state.ResumeTiming();
+		}
+		void *obj = mempool_alloc(&pool);
+		if (obj == NULL) {
+			state.SkipWithError("Failed to allocate memory");
+			break;
+		}
+		memset(obj, 0, objsize);
+		objs[allocated++] = obj;
+	}
+	state.SetItemsProcessed(state.iterations());
+	for (size_t i = 0; i < allocated; i++)
+		mempool_free(&pool, objs[i]);
+	mempool_test_finish();
+}
+
+BENCHMARK(mempool_cold_alloc)
+	->Args({64, 1 << 21, 0})
+	->Args({64, 1 << 21, MEMPOOL_PREFETCH})
+	->Args({256, 1 << 19, 0})
+	->Args({256, 1 << 19, MEMPOOL_PREFETCH})
+	->ArgNames({"objsize", "count", "flags"});
+
+BENCHMARK_MAIN();
@@ -0,0 +1,157 @@
+/*
+ * Copyright 2010-2021, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include "slab_cache.h"
+#include "quota.h"
+
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+enum {
+	/** Arena slab size. */
+	SLAB_SIZE = 4194304,
+	/** Live slabs kept by the fragmented workload. */
+	LIVE_SLABS = 4096,
+};
+
+static struct quota quota;
+static struct slab_arena arena;
+static struct slab_cache cache;
+
+static void
+slab_cache_test_start(void)
+{
+	quota_init(&quota, UINT_MAX);
+	slab_arena_create(&arena, &quota, 0, SLAB_SIZE, MAP_PRIVATE);
+	slab_cache_create(&cache, &arena);
+}
+
+static void
+slab_cache_test_finish(void)
+{
+	slab_cache_destroy(&cache);
+	slab_arena_destroy(&arena);
+}
+
+/**
+ * Get and put back a slab of the same order: the slab is split
+ * from a free slab of order_max and merged back every time.
+ */
+static void
+slab_cache_split_merge(benchmark::State& state)
+{
+	uint8_t order = state.range(0);
+	slab_cache_test_start();
+	/* Keep an order_max slab in the cache. */
+	struct slab *spare = slab_get_with_order(&cache, cache.order_max);
+	slab_put_with_order(&cache, spare);
+	for (auto _ : state) {
+		struct slab *slab = slab_get_with_order(&cache, order);
+		benchmark::DoNotOptimize(slab);
+		slab_put_with_order(&cache, slab);
+	}
+	state.SetItemsProcessed(state.iterations());
+	slab_cache_test_finish();
+}
+
+BENCHMARK(slab_cache_split_merge)->Arg(0)->Arg(4)->Arg(8);
+
+/**
+ * Keep LIVE_SLABS slabs of random orders, replacing a random
+ * one on each iteration, so that free slabs of various orders
+ * are scattered over many arena slabs.
+ */
+static void
+slab_cache_fragmented(benchmark::State& state)
+{
+	unsigned order_range = state.range(0);
+	slab_cache_test_start();
+	std::vector<struct slab *> live(LIVE_SLABS);
+	for (auto &slab : live) {
+		slab = slab_get_with_order(&cache, rand() % order_range);
+		if (slab == NULL) {
+			state.SkipWithError("Failed to allocate memory");
+			return;
+		}
+	}
+	for (auto _ : state) {
+		unsigned i = rand() % LIVE_SLABS;
+		slab_put_with_order(&cache, live[i]);
+		live[i] = slab_get_with_order(&cache, rand() % order_range);
+		if (live[i] == NULL) {
+			state.SkipWithError("Failed to allocate memory");
+			break;
+		}
+	}
+	state.SetItemsProcessed(state.iterations());
+	for (auto slab : live) {
+		if (slab != NULL)
+			slab_put_with_order(&cache, slab);
+	}
+	slab_cache_test_finish();
+}
+
+BENCHMARK(slab_cache_fragmented)->Arg(2)->Arg(6)->Arg(10);
+
+/**
+ * Get and put back a burst of order 0 slabs, one by one or
+ * with the batch functions.
+ */
+static void
+slab_cache_burst(benchmark::State& state)
+{
+	size_t count = state.range(0);
+	bool batch = state.range(1);
+	slab_cache_test_start();
+	std::vector<struct slab *> slabs(count);
+	/* Keep an order_max slab in the cache. */
+	struct slab *spare = slab_get_with_order(&cache, cache.order_max);
+	slab_put_with_order(&cache, spare);
+	for (auto _ : state) {
+		if (batch) {
+			slab_get_batch(&cache, 0, count, slabs.data());
+			slab_put_batch(&cache, slabs.data(), count);
+			continue;
+		}
+		for (auto &slab : slabs)
+			slab = slab_get_with_order(&cache, 0);
+		for (auto slab : slabs)
+			slab_put_with_order(&cache, slab);
+	}
+	state.SetItemsProcessed(state.iterations() * count);
+	slab_cache_test_finish();
+}
+
+BENCHMARK(slab_cache_burst)
+	->Args({32, 0})->Args({32, 1})
+	->ArgNames({"count", "batch"});
+
+BENCHMARK_MAIN();
@@ -284,6 +284,57 @@ BENCHMARK(small_workload_benchmark)
 	->ArgNames({"slab_size", "size_min", "size_max", "prealloc", "mask",
 		    "alloc_factor_idx"});
 
+/**
+ * Allocate short-lived objects of 32 to 256 bytes, freeing each
+ * one a few allocations later, with or without passing its size.
+ */
+static void
+small_short_lived_benchmark(benchmark::State& state)
+{
+	unsigned tcache_size = state.range(0);
+	bool nosize = state.range(1);
+	enum { LIVE = 16, SIZES = 1024 };
+	small_alloc_test_start(SLAB_SIZE_MIN, alloc_factor_arr[0]);
+	if (nosize)
+		small_alloc_enable_nosize(&alloc);
+	small_alloc_set_tcache_size(&alloc, tcache_size);
+	std::array<size_t, SIZES> sizes;
+	for (auto &size : sizes)
+		size = 32 + rand() % 225;
+	std::array<struct allocation, LIVE> live = {};
+	unsigned i = 0;
+	for (auto _ : state) {
+		struct allocation &a = live[i % LIVE];
+		if (a.ptr != NULL && nosize)
+			smfree_nosize(&alloc, a.ptr);
+		else if (a.ptr != NULL)
+			smfree(&alloc, a.ptr, a.size);
+		a.size = sizes[i % SIZES];
+		a.ptr = smalloc(&alloc, a.size);
+		if (a.ptr == NULL) {
+			state.SkipWithError("Failed to allocate memory");
+			break;
+		}
+		i++;
+	}
+	state.SetItemsProcessed(state.iterations());
+	for (auto &a : live) {
+		if (a.ptr != NULL)
+			smfree(&alloc, a.ptr, a.size);
+	}
+	small_alloc_set_tcache_size(&alloc, 0);
+	if (! small_is_unused())
+		state.SkipWithError("Not all memory was released");
+	small_alloc_test_finish();
+}
+
+BENCHMARK(small_short_lived_benchmark)
+	->Args({0, 0})
+	->Args({32, 0})
+	->Args({0, 1})
+	->Args({32, 1})
+	->ArgNames({"tcache_size", "nosize"});
+
 int main(int argc, char** argv)
 {
 	srand(time(NULL) / (5 * 60));
@@ -91,15 +91,33 @@ ibuf_reserve_slow(struct ibuf *ibuf, size_t size)
 		while (new_capacity < used + size)
 			new_capacity *= 2;
 
-		struct slab *slab = slab_get(ibuf->slabc, new_capacity);
-		if (slab == NULL)
-			return NULL;
-		char *ptr = (char *) slab_data(slab);
-		memcpy(ptr, ibuf->rpos, used);
-		if (ibuf->buf)
-			slab_put(ibuf->slabc, slab_from_data(ibuf->buf));
-		ibuf->buf = ptr;
-		ibuf->end = ibuf->buf + slab_capacity(slab);
+#ifndef ENABLE_ASAN
+		struct slab *old = ibuf->buf != NULL ?
+				   slab_from_data(ibuf->buf) : NULL;
+		if (old != NULL && old->order == ibuf->slabc->order_max + 1) {
+			/* Big buffers are remapped, not copied. */
+			struct slab *slab =
+				slab_grow_large(ibuf->slabc, old, new_capacity,
+						ibuf->rpos - ibuf->buf, used);
+			if (slab == NULL)
+				return NULL;
+			ibuf->buf = (char *) slab_data(slab);
+			ibuf->end = ibuf->buf + slab_capacity(slab);
+		} else
+#endif
+		{
+			struct slab *slab = slab_get(ibuf->slabc,
+						     new_capacity);
+			if (slab == NULL)
+				return NULL;
+			char *ptr = (char *) slab_data(slab);
+			memcpy(ptr, ibuf->rpos, used);
+			if (ibuf->buf)
+				slab_put(ibuf->slabc,
+					 slab_from_data(ibuf->buf));
+			ibuf->buf = ptr;
+			ibuf->end = ibuf->buf + slab_capacity(slab);
+		}
 	}
 	ibuf->rpos = ibuf->buf;
 	ibuf->wpos = ibuf->rpos + used;
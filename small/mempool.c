@@ -33,12 +33,16 @@
 #include <string.h>
 #include <valgrind/valgrind.h>
 #include <valgrind/memcheck.h>
+#include <pmatomic.h>
 
 #include "slab_cache.h"
 
 /* slab fragmentation must reach 1/8 before it's recycled */
 enum { MAX_COLD_FRACTION_LB = 3 };
 
+/* the number of slab colors and the slab share they may take */
+enum { COLOR_COUNT_MAX = 8, COLOR_FRACTION_LB = 5 };
+
 static inline int
 mslab_cmp(const struct mslab *lhs, const struct mslab *rhs)
 {
@@ -50,20 +54,136 @@ rb_proto(, mslab_tree_, mslab_tree_t, struct mslab)
 
 rb_gen(, mslab_tree_, mslab_tree_t, struct mslab, next_in_hot, mslab_cmp)
 
+/** Link two pairing heaps, return the root of the result. */
+static inline struct mslab *
+mslab_heap_meld(struct mslab *a, struct mslab *b)
+{
+	if (a == NULL)
+		return b;
+	if (b == NULL)
+		return a;
+	if (mslab_cmp(a, b) > 0) {
+		struct mslab *tmp = a;
+		a = b;
+		b = tmp;
+	}
+	b->in_heap.prev = a;
+	b->in_heap.next = a->in_heap.child;
+	if (a->in_heap.child != NULL)
+		a->in_heap.child->in_heap.prev = b;
+	a->in_heap.child = b;
+	return a;
+}
+
+/**
+ * Meld a list of sibling heaps in two passes: pairwise left
+ * to right, then the pairs right to left.
+ */
+static struct mslab *
+mslab_heap_merge_pairs(struct mslab *first)
+{
+	struct mslab *pairs = NULL;
+	while (first != NULL) {
+		struct mslab *a = first;
+		struct mslab *b = a->in_heap.next;
+		first = b != NULL ? b->in_heap.next : NULL;
+		a->in_heap.next = a->in_heap.prev = NULL;
+		if (b != NULL)
+			b->in_heap.next = b->in_heap.prev = NULL;
+		a = mslab_heap_meld(a, b);
+		a->in_heap.next = pairs;
+		pairs = a;
+	}
+	struct mslab *root = NULL;
+	while (pairs != NULL) {
+		struct mslab *next = pairs->in_heap.next;
+		pairs->in_heap.next = NULL;
+		root = mslab_heap_meld(root, pairs);
+		pairs = next;
+	}
+	return root;
+}
+
+/** Add a slab to the hot slabs. */
+static inline void
+mslab_hot_insert(struct mempool *pool, struct mslab *slab)
+{
+	assert(slab->in_hot_slabs == false);
+	if (pool->flags & MEMPOOL_PAIRING_HEAP) {
+		slab->in_heap.child = NULL;
+		slab->in_heap.next = NULL;
+		slab->in_heap.prev = NULL;
+		pool->first_hot_slab =
+			mslab_heap_meld(pool->first_hot_slab, slab);
+	} else {
+		mslab_tree_insert(&pool->hot_slabs, slab);
+		/*
+		 * Update first_hot_slab pointer if the newly
+		 * added tree node is the leftmost.
+		 */
+		if (pool->first_hot_slab == NULL ||
+		    mslab_cmp(pool->first_hot_slab, slab) == 1) {
+			pool->first_hot_slab = slab;
+		}
+	}
+	slab->in_hot_slabs = true;
+}
+
+/** Remove a slab from the hot slabs. */
+static inline void
+mslab_hot_remove(struct mempool *pool, struct mslab *slab)
+{
+	assert(slab->in_hot_slabs);
+	if (pool->flags & MEMPOOL_PAIRING_HEAP) {
+		struct mslab *children =
+			mslab_heap_merge_pairs(slab->in_heap.child);
+		if (slab == pool->first_hot_slab) {
+			pool->first_hot_slab = children;
+		} else {
+			struct mslab *prev = slab->in_heap.prev;
+			if (prev->in_heap.child == slab)
+				prev->in_heap.child = slab->in_heap.next;
+			else
+				prev->in_heap.next = slab->in_heap.next;
+			if (slab->in_heap.next != NULL)
+				slab->in_heap.next->in_heap.prev = prev;
+			pool->first_hot_slab =
+				mslab_heap_meld(pool->first_hot_slab,
+						children);
+		}
+	} else {
+		if (slab == pool->first_hot_slab) {
+			pool->first_hot_slab =
+				mslab_tree_next(&pool->hot_slabs, slab);
+		}
+		mslab_tree_remove(&pool->hot_slabs, slab);
+	}
+	slab->in_hot_slabs = false;
+}
+
 static inline void
 mslab_create(struct mslab *slab, struct mempool *pool)
 {
 	slab->nfree = pool->objcount;
-	slab->free_offset = pool->offset;
+	slab->offset = pool->offset - pool->color_next * pool->color_step;
+	if (++pool->color_next == pool->color_count)
+		pool->color_next = 0;
+	slab->free_offset = slab->offset;
 	slab->free_list = NULL;
 	slab->in_hot_slabs = false;
 	slab->mempool = pool;
+	slab->remote_free = NULL;
+	slab->next_remote = NULL;
 
 	rlist_create(&slab->next_in_cold);
 }
 
-void *
-mslab_alloc(struct mempool *pool, struct mslab *slab)
+/**
+ * Take a free object from a slab. Unlike mslab_alloc(), leaves
+ * the slab lists alone.
+ */
+static inline void *
+mslab_take(struct mempool *pool, struct mslab *slab)
 {
 	assert(slab->nfree);
 	void *result;
@@ -77,21 +197,26 @@ mslab_alloc(struct mempool *pool, struct mslab *slab)
 		 * memcpy can work with misaligned address.
 		 */
 		memcpy(&slab->free_list, slab->free_list, sizeof(void *));
+		if (pool->flags & MEMPOOL_PREFETCH)
+			__builtin_prefetch(slab->free_list, 0);
 	} else {
 		/* Use an object from the "untouched" area of the slab. */
 		result = (char *)slab + slab->free_offset;
 		slab->free_offset += pool->objsize;
+		if (pool->flags & MEMPOOL_PREFETCH)
+			__builtin_prefetch((char *)slab + slab->free_offset, 1);
 	}
+	slab->nfree--;
+	return result;
+}
 
+void *
+mslab_alloc(struct mempool *pool, struct mslab *slab)
+{
+	void *result = mslab_take(pool, slab);
 	/* If the slab is full, remove it from the rb tree. */
-	if (--slab->nfree == 0) {
-		if (slab == pool->first_hot_slab) {
-			pool->first_hot_slab = mslab_tree_next(&pool->hot_slabs,
-							       slab);
-		}
-		mslab_tree_remove(&pool->hot_slabs, slab);
-		slab->in_hot_slabs = false;
-	}
+	if (slab->nfree == 0)
+		mslab_hot_remove(pool, slab);
 	return result;
 }
 
@@ -119,26 +244,12 @@ mslab_free(struct mempool *pool, struct mslab *slab, void *ptr)
 		 * sufficiently fragmented slabs.
 		 */
 		rlist_del_entry(slab, next_in_cold);
-		mslab_tree_insert(&pool->hot_slabs, slab);
-		slab->in_hot_slabs = true;
-		/*
-		 * Update first_hot_slab pointer if the newly
-		 * added tree node is the leftmost.
-		 */
-		if (pool->first_hot_slab == NULL ||
-		    mslab_cmp(pool->first_hot_slab, slab) == 1) {
-			pool->first_hot_slab = slab;
-		}
+		mslab_hot_insert(pool, slab);
 	} else if (slab->nfree == 1) {
 		rlist_add_entry(&pool->cold_slabs, slab, next_in_cold);
 	} else if (slab->nfree == pool->objcount) {
 		/** Free the slab. */
-		if (slab == pool->first_hot_slab) {
-			pool->first_hot_slab =
-				mslab_tree_next(&pool->hot_slabs, slab);
-		}
-		mslab_tree_remove(&pool->hot_slabs, slab);
-		slab->in_hot_slabs = false;
+		mslab_hot_remove(pool, slab);
 		if (pool->spare > slab) {
 			mempool_free_spare_slab(pool);
 			pool->spare = slab;
@@ -152,6 +263,93 @@ mslab_free(struct mempool *pool, struct mslab *slab, void *ptr)
 	}
 }
 
+/** Return @a count objects from the magazine to their slabs. */
+static void
+mempool_flush_magazine(struct mempool *pool, uint32_t count)
+{
+	assert(count <= pool->magazine_count);
+	for (; count > 0; count--) {
+		void *ptr = pool->magazine;
+		memcpy(&pool->magazine, ptr, sizeof(void *));
+		pool->magazine_count--;
+		VALGRIND_MALLOCLIKE_BLOCK(ptr, pool->objsize, 0, 0);
+		struct mslab *slab = (struct mslab *)
+			slab_from_ptr(ptr, pool->slab_ptr_mask);
+		mslab_free(pool, slab, ptr);
+	}
+}
+
+void
+mempool_magazine_put(struct mempool *pool, void *ptr)
+{
+	if (pool->magazine_count == pool->magazine_size)
+		mempool_flush_magazine(pool, (pool->magazine_size + 1) / 2);
+	/* The same unaligned store as in mslab_free(). */
+	memcpy(ptr, &pool->magazine, sizeof(void *));
+	pool->magazine = ptr;
+	pool->magazine_count++;
+	VALGRIND_FREELIKE_BLOCK(ptr, 0);
+	VALGRIND_MAKE_MEM_DEFINED(ptr, sizeof(void *));
+}
+
+void
+mempool_set_magazine_size(struct mempool *pool, uint32_t size)
+{
+	pool->magazine_size = size;
+	if (pool->magazine_count > size)
+		mempool_flush_magazine(pool, pool->magazine_count - size);
+}
+
+/** Calculate the placement of objects in slabs. */
+static void
+mempool_layout(struct mempool *pool)
+{
+	/* Total size of slab */
+	uint32_t slab_size = slab_order_size(pool->cache, pool->slab_order);
+	uint32_t objsize = pool->objsize;
+	uint32_t start = mslab_sizeof();
+	uint32_t reserve = 0;
+	pool->color_step = 0;
+	pool->color_count = 1;
+	pool->color_next = 0;
+	if (pool->flags & MEMPOOL_NO_STRADDLE) {
+		/* Start objects at a cache line boundary. */
+		start = small_align(start, SMALL_CACHELINE_SIZE);
+	}
+	if (pool->flags & MEMPOOL_COLORING) {
+		/*
+		 * Keep the alignment objects get from their size
+		 * at the end of the slab. Reserve room for the
+		 * colors unless it takes too much of the slab.
+		 */
+		uint32_t step = objsize & -objsize;
+		if (step < SMALL_CACHELINE_SIZE)
+			step = SMALL_CACHELINE_SIZE;
+		uint32_t room = (COLOR_COUNT_MAX - 1) * step;
+		if (room > slab_size >> COLOR_FRACTION_LB)
+			room = slab_size >> COLOR_FRACTION_LB;
+		room -= room % step;
+		if (start + room + objsize <= slab_size)
+			reserve = room;
+		pool->color_step = step;
+	}
+	/* Calculate how many objects will actually fit in a slab. */
+	pool->objcount = (slab_size - start - reserve) / objsize;
+	if ((pool->flags & MEMPOOL_NO_STRADDLE) &&
+	    objsize < SMALL_CACHELINE_SIZE) {
+		uint32_t per_line = SMALL_CACHELINE_SIZE / objsize;
+		pool->objcount -= pool->objcount % per_line;
+	}
+	assert(pool->objcount);
+	pool->offset = slab_size - pool->objcount * pool->objsize;
+	if (pool->color_step != 0) {
+		pool->color_count = (pool->offset - start) /
+				    pool->color_step + 1;
+		if (pool->color_count > COLOR_COUNT_MAX)
+			pool->color_count = COLOR_COUNT_MAX;
+	}
+}
+
 void
 mempool_create_with_order(struct mempool *pool, struct slab_cache *cache,
 			  uint32_t objsize, uint8_t order)
@@ -163,16 +361,31 @@ mempool_create_with_order(struct mempool *pool, struct slab_cache *cache,
 	pool->first_hot_slab = NULL;
 	rlist_create(&pool->cold_slabs);
 	pool->spare = NULL;
+	pool->magazine = NULL;
+	pool->magazine_count = 0;
+	pool->magazine_size = 0;
 	pool->objsize = objsize;
 	pool->slab_order = order;
-	/* Total size of slab */
-	uint32_t slab_size = slab_order_size(pool->cache, pool->slab_order);
-	/* Calculate how many objects will actually fit in a slab. */
-	pool->objcount = (slab_size - mslab_sizeof()) / objsize;
-	assert(pool->objcount);
-	pool->offset = slab_size - pool->objcount * pool->objsize;
 	pool->slab_ptr_mask = ~(slab_order_size(cache, order) - 1);
 	pool->small_mempool = NULL;
+	pool->flags = 0;
+	pool->remote_slabs = NULL;
+	mempool_layout(pool);
+}
+
+void
+mempool_set_flags(struct mempool *pool, uint32_t flags)
+{
+	assert(pool->slabs.stats.total == 0);
+	pool->flags = flags;
+	if (flags & MEMPOOL_NO_STRADDLE) {
+		uint32_t line = SMALL_CACHELINE_SIZE;
+		if (pool->objsize > line)
+			pool->objsize = small_align(pool->objsize, line);
+		else
+			pool->objsize = small_round(pool->objsize);
+	}
+	mempool_layout(pool);
 }
 
 void
@@ -186,31 +399,104 @@ mempool_destroy(struct mempool *pool)
 	memset(pool, 0, sizeof(*pool));
 }
 
-void *
-mempool_alloc(struct mempool *pool)
+/**
+ * Find a slab with free objects: the leftmost hot slab, the
+ * spare, a new slab or a cold one. The slab is in the hot
+ * slabs tree on return.
+ */
+static struct mslab *
+mempool_hot_slab(struct mempool *pool)
 {
 	struct mslab *slab = pool->first_hot_slab;
-	if (slab == NULL) {
-		if (pool->spare) {
-			slab = pool->spare;
-			pool->spare = NULL;
-
-		} else if ((slab = (struct mslab *)
-			    slab_get_with_order(pool->cache,
-						pool->slab_order))) {
-			mslab_create(slab, pool);
-			slab_list_add(&pool->slabs, &slab->slab, next_in_list);
-		} else if (! rlist_empty(&pool->cold_slabs)) {
-			slab = rlist_shift_entry(&pool->cold_slabs, struct mslab,
-						 next_in_cold);
-		} else {
-			return NULL;
+	if (slab != NULL)
+		return slab;
+	if (pool->spare) {
+		slab = pool->spare;
+		pool->spare = NULL;
+
+	} else if ((slab = (struct mslab *)
+		    slab_get_with_order(pool->cache,
+					pool->slab_order))) {
+		mslab_create(slab, pool);
+		slab_list_add(&pool->slabs, &slab->slab, next_in_list);
+	} else if (! rlist_empty(&pool->cold_slabs)) {
+		slab = rlist_shift_entry(&pool->cold_slabs, struct mslab,
+					 next_in_cold);
+	} else {
+		return NULL;
+	}
+	mslab_hot_insert(pool, slab);
+	return slab;
+}
+
+void
+mempool_free_remote(struct mempool *pool, void *ptr)
+{
+	struct mslab *slab = (struct mslab *)
+		slab_from_ptr(ptr, pool->slab_ptr_mask);
+	assert(slab->slab.order == pool->slab_order);
+#ifndef NDEBUG
+	memset(ptr, '#', pool->objsize);
+#endif
+	void *head = pm_atomic_load(&slab->remote_free);
+	do {
+		memcpy(ptr, &head, sizeof(void *));
+	} while (!pm_atomic_compare_exchange_weak(&slab->remote_free,
+						  &head, ptr));
+	if (head != NULL)
+		return;
+	/*
+	 * The list was empty, so the slab is not in remote_slabs
+	 * and can not be collected until it is added there.
+	 */
+	struct mslab *next = pm_atomic_load(&pool->remote_slabs);
+	do {
+		slab->next_remote = next;
+	} while (!pm_atomic_compare_exchange_weak(&pool->remote_slabs,
+						  &next, slab));
+}
+
+void
+mempool_collect_remote(struct mempool *pool)
+{
+	struct mslab *slab = pm_atomic_exchange(&pool->remote_slabs, NULL);
+	while (slab != NULL) {
+		/*
+		 * Read the link first: once remote_free is reset,
+		 * another thread may add the slab to the list again.
+		 */
+		struct mslab *next = slab->next_remote;
+		void *ptr = pm_atomic_exchange(&slab->remote_free, NULL);
+		while (ptr != NULL) {
+			void *next_ptr;
+			memcpy(&next_ptr, ptr, sizeof(void *));
+			pool->slabs.stats.used -= pool->objsize;
+			mslab_free(pool, slab, ptr);
+			ptr = next_ptr;
 		}
-		assert(slab->in_hot_slabs == false);
-		mslab_tree_insert(&pool->hot_slabs, slab);
-		slab->in_hot_slabs = true;
-		pool->first_hot_slab = slab;
+		slab = next;
+	}
+}
+
+void *
+mempool_alloc(struct mempool *pool)
+{
+	if (pm_atomic_load_explicit(&pool->remote_slabs,
+				    pm_memory_order_relaxed) != NULL)
+		mempool_collect_remote(pool);
+	if (pool->magazine != NULL) {
+		void *ptr = pool->magazine;
+		memcpy(&pool->magazine, ptr, sizeof(void *));
+		pool->magazine_count--;
+		if (pool->flags & MEMPOOL_PREFETCH)
+			__builtin_prefetch(pool->magazine, 0);
+		pool->slabs.stats.used += pool->objsize;
+		VALGRIND_MALLOCLIKE_BLOCK(ptr, pool->objsize, 0, 0);
+		return ptr;
 	}
+	struct mslab *slab = mempool_hot_slab(pool);
+	if (slab == NULL)
+		return NULL;
 	pool->slabs.stats.used += pool->objsize;
 	void *ptr = mslab_alloc(pool, slab);
 	assert(ptr != NULL);
@@ -218,6 +504,317 @@ mempool_alloc(struct mempool *pool)
 	return ptr;
 }
 
+uint32_t
+mempool_alloc_batch(struct mempool *pool, void **objs, uint32_t count)
+{
+	if (pm_atomic_load_explicit(&pool->remote_slabs,
+				    pm_memory_order_relaxed) != NULL)
+		mempool_collect_remote(pool);
+	uint32_t done = 0;
+	while (done < count && pool->magazine != NULL) {
+		void *ptr = pool->magazine;
+		memcpy(&pool->magazine, ptr, sizeof(void *));
+		pool->magazine_count--;
+		objs[done++] = ptr;
+	}
+	struct mslab *slab;
+	while (done < count && (slab = mempool_hot_slab(pool)) != NULL) {
+		uint32_t n = count - done;
+		if (n > slab->nfree)
+			n = slab->nfree;
+		uint32_t i = 0;
+		for (; i < n && slab->free_list != NULL; i++) {
+			objs[done + i] = slab->free_list;
+			memcpy(&slab->free_list, slab->free_list,
+			       sizeof(void *));
+		}
+		/* The rest comes from the untouched area. */
+		for (; i < n; i++) {
+			objs[done + i] = (char *)slab + slab->free_offset;
+			slab->free_offset += pool->objsize;
+		}
+		done += n;
+		slab->nfree -= n;
+		if (slab->nfree == 0)
+			mslab_hot_remove(pool, slab);
+	}
+	pool->slabs.stats.used += (size_t)done * pool->objsize;
+	for (uint32_t i = 0; i < done; i++)
+		VALGRIND_MALLOCLIKE_BLOCK(objs[i], pool->objsize, 0, 0);
+	return done;
+}
+
+/**
+ * Move a slab between the cold list, the hot slabs tree and
+ * the slab cache after its free objects count has grown from
+ * @a nfree. A generalization of the bookkeeping done by
+ * mslab_free() for a single object.
+ */
+static void
+mslab_update_free(struct mempool *pool, struct mslab *slab, uint32_t nfree)
+{
+	if (slab->in_hot_slabs == false &&
+	    slab->nfree >= (pool->objcount >> MAX_COLD_FRACTION_LB)) {
+		rlist_del_entry(slab, next_in_cold);
+		mslab_hot_insert(pool, slab);
+	} else if (slab->in_hot_slabs == false && nfree == 0) {
+		rlist_add_entry(&pool->cold_slabs, slab, next_in_cold);
+	}
+	if (slab->nfree < pool->objcount)
+		return;
+	mslab_hot_remove(pool, slab);
+	if (pool->spare > slab) {
+		mempool_free_spare_slab(pool);
+		pool->spare = slab;
+	} else if (pool->spare) {
+		slab_list_del(&pool->slabs, &slab->slab, next_in_list);
+		slab_put_with_order(pool->cache, &slab->slab);
+	} else {
+		pool->spare = slab;
+	}
+}
+
+void
+mempool_free_batch(struct mempool *pool, void **objs, uint32_t count)
+{
+	uint32_t i = 0;
+	while (i < count) {
+		struct mslab *slab = (struct mslab *)
+			slab_from_ptr(objs[i], pool->slab_ptr_mask);
+		assert(slab->slab.order == pool->slab_order);
+		uint32_t nfree = slab->nfree;
+		do {
+			void *ptr = objs[i];
+#ifndef NDEBUG
+			memset(ptr, '#', pool->objsize);
+#endif
+			memcpy(ptr, &slab->free_list, sizeof(void *));
+			slab->free_list = ptr;
+			VALGRIND_FREELIKE_BLOCK(ptr, 0);
+			VALGRIND_MAKE_MEM_DEFINED(ptr, sizeof(void *));
+			slab->nfree++;
+		} while (++i < count &&
+			 slab_from_ptr(objs[i], pool->slab_ptr_mask) ==
+			 &slab->slab);
+		pool->slabs.stats.used -=
+			(size_t)(slab->nfree - nfree) * pool->objsize;
+		mslab_update_free(pool, slab, nfree);
+	}
+}
+
+/** The size of a bitmap with a bit per object of a slab. */
+static inline size_t
+mslab_map_size(struct mempool *pool)
+{
+	return (pool->objcount + 63) / 64 * sizeof(uint64_t);
+}
+
+/**
+ * Fill @a map with a bit per object of @a slab, set if the
+ * object is free. Objects in the magazine and in remote free
+ * lists are reported as used.
+ */
+static void
+mslab_free_map(struct mempool *pool, struct mslab *slab, uint64_t *map)
+{
+	memset(map, 0, mslab_map_size(pool));
+	uint32_t i = (slab->free_offset - slab->offset) / pool->objsize;
+	for (; i < pool->objcount; i++)
+		map[i / 64] |= (uint64_t)1 << (i % 64);
+	void *ptr = slab->free_list;
+	while (ptr != NULL) {
+		i = ((char *)ptr - (char *)slab - slab->offset) /
+		    pool->objsize;
+		map[i / 64] |= (uint64_t)1 << (i % 64);
+		memcpy(&ptr, ptr, sizeof(void *));
+	}
+}
+
+/**
+ * Defragmentation order of slabs: the ones with fewer used
+ * objects go first, address breaks ties.
+ */
+static inline bool
+mslab_defrag_before(uint32_t nfree, const struct mslab *slab,
+		    const struct mslab *other)
+{
+	if (nfree != other->nfree)
+		return nfree > other->nfree;
+	return slab < other;
+}
+
+/**
+ * Find the most used slab that has free objects and goes after
+ * @a src having @a nfree free objects in the defragmentation
+ * order.
+ */
+static struct mslab *
+mempool_defrag_dst(struct mempool *pool, uint32_t nfree, struct mslab *src)
+{
+	struct mslab *dst = NULL;
+	struct slab *slab;
+	rlist_foreach_entry(slab, &pool->slabs.slabs, next_in_list) {
+		struct mslab *mslab = (struct mslab *)slab;
+		if (mslab == src || mslab->nfree == 0 ||
+		    mslab->nfree == pool->objcount ||
+		    !mslab_defrag_before(nfree, src, mslab))
+			continue;
+		if (dst == NULL || mslab->nfree < dst->nfree)
+			dst = mslab;
+	}
+	return dst;
+}
+
+size_t
+mempool_defrag(struct mempool *pool, size_t budget,
+	       mempool_move_cb move_cb, void *arg)
+{
+	mempool_collect_remote(pool);
+	mempool_flush_magazine(pool, pool->magazine_count);
+	struct slab *map_slab = slab_get(pool->cache, mslab_map_size(pool));
+	if (map_slab == NULL)
+		return 0;
+	uint64_t *map = (uint64_t *)slab_data(map_slab);
+	size_t moved = 0;
+	/* Slabs up to this one are evacuated or pinned. */
+	uint32_t last_nfree = pool->objcount;
+	struct mslab *last = NULL;
+	while (moved < budget) {
+		/*
+		 * Pick the sparsest slab not tried yet and count
+		 * free objects in the denser ones.
+		 */
+		struct mslab *src = NULL;
+		struct slab *slab;
+		rlist_foreach_entry(slab, &pool->slabs.slabs, next_in_list) {
+			struct mslab *mslab = (struct mslab *)slab;
+			if (mslab->nfree == 0 ||
+			    mslab->nfree == pool->objcount ||
+			    !mslab_defrag_before(last_nfree, last, mslab))
+				continue;
+			if (src == NULL ||
+			    mslab_defrag_before(mslab->nfree, mslab, src))
+				src = mslab;
+		}
+		if (src == NULL)
+			break;
+		size_t room = 0;
+		rlist_foreach_entry(slab, &pool->slabs.slabs, next_in_list) {
+			struct mslab *mslab = (struct mslab *)slab;
+			if (mslab != src && mslab->nfree < pool->objcount &&
+			    mslab_defrag_before(src->nfree, src, mslab))
+				room += mslab->nfree;
+		}
+		if (room < pool->objcount - src->nfree)
+			break;
+		last_nfree = src->nfree;
+		last = src;
+		/* src may be released once its last object is moved. */
+		char *objs = (char *)src + src->offset;
+		uint32_t used = pool->objcount - src->nfree;
+		mslab_free_map(pool, src, map);
+		struct mslab *dst = NULL;
+		for (uint32_t i = 0; used > 0 && moved < budget; i++) {
+			if (map[i / 64] & ((uint64_t)1 << (i % 64)))
+				continue;
+			void *old_obj = objs + (size_t)i * pool->objsize;
+			if (dst == NULL || dst->nfree == 0)
+				dst = mempool_defrag_dst(pool, last_nfree,
+							 src);
+			assert(dst != NULL);
+			void *new_obj = mslab_take(pool, dst);
+			if (dst->nfree == 0) {
+				if (dst->in_hot_slabs)
+					mslab_hot_remove(pool, dst);
+				else
+					rlist_del_entry(dst, next_in_cold);
+			}
+			VALGRIND_MALLOCLIKE_BLOCK(new_obj, pool->objsize, 0, 0);
+			if (!move_cb(old_obj, new_obj, arg)) {
+				mslab_free(pool, dst, new_obj);
+				break;
+			}
+#ifndef NDEBUG
+			memset(old_obj, '#', pool->objsize);
+#endif
+			used--;
+			moved++;
+			mslab_free(pool, src, old_obj);
+		}
+	}
+	slab_put(pool->cache, map_slab);
+	return moved;
+}
+
+/**
+ * Move the iterator to the next slab having allocated objects
+ * and build its bitmap.
+ */
+static void
+mempool_iterator_next_slab(struct mempool_iterator *it)
+{
+	struct mempool *pool = it->pool;
+	struct rlist *link = it->slab == NULL ? &pool->slabs.slabs :
+			     &it->slab->slab.next_in_list;
+	it->slab = NULL;
+	it->idx = 0;
+	while ((link = rlist_next(link)) != &pool->slabs.slabs) {
+		struct mslab *slab = (struct mslab *)
+			rlist_entry(link, struct slab, next_in_list);
+		if (slab->nfree < pool->objcount) {
+			it->slab = slab;
+			mslab_free_map(pool, slab, it->map);
+			break;
+		}
+	}
+}
+
+int
+mempool_iterator_create(struct mempool_iterator *it, struct mempool *pool)
+{
+	mempool_collect_remote(pool);
+	mempool_flush_magazine(pool, pool->magazine_count);
+	it->pool = pool;
+	it->slab = NULL;
+	it->map_slab = slab_get(pool->cache, mslab_map_size(pool));
+	if (it->map_slab == NULL)
+		return -1;
+	it->map = (uint64_t *)slab_data(it->map_slab);
+	mempool_iterator_next_slab(it);
+	return 0;
+}
+
+void *
+mempool_iterator_next(struct mempool_iterator *it)
+{
+	struct mempool *pool = it->pool;
+	while (it->slab != NULL) {
+		/* Look for a clear bit a word at a time. */
+		while (it->idx < pool->objcount) {
+			uint64_t used = ~it->map[it->idx / 64] >>
+					(it->idx % 64);
+			if (used == 0) {
+				it->idx = small_align(it->idx + 1, 64);
+				continue;
+			}
+			uint32_t i = it->idx + __builtin_ctzll(used);
+			if (i >= pool->objcount)
+				break;
+			it->idx = i + 1;
+			return (char *)it->slab + it->slab->offset +
+			       (size_t)i * pool->objsize;
+		}
+		mempool_iterator_next_slab(it);
+	}
+	return NULL;
+}
+
+void
+mempool_iterator_destroy(struct mempool_iterator *it)
+{
+	slab_put(it->pool->cache, it->map_slab);
+}
+
 void
 mempool_stats(struct mempool *pool, struct mempool_stats *stats)
 {
@@ -39,21 +39,41 @@
 #include <stdbool.h>
 #include <assert.h>
 #include <limits.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <pmatomic.h>
 #include <valgrind/valgrind.h>
 #include <valgrind/memcheck.h>
 
-static void
-madvise_checked(void *ptr, size_t size, int flags)
-{
-#ifdef TARANTOOL_SMALL_USE_MADVISE
-	if (!ptr)
-		return;
+#ifdef TARANTOOL_SMALL_USE_NUMA
+#include <unistd.h>
+#include <sys/syscall.h>
 
-	if (!IS_SLAB_ARENA_FLAG(flags, SLAB_ARENA_DONTDUMP))
-		return;
+/* Defined in <linux/mempolicy.h> which is not always installed. */
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED	1
+#endif
+#ifndef MPOL_F_NODE
+#define MPOL_F_NODE	(1 << 0)
+#endif
+#ifndef MPOL_F_ADDR
+#define MPOL_F_ADDR	(1 << 1)
+#endif
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE	(1 << 1)
+#endif
+#endif /* TARANTOOL_SMALL_USE_NUMA */
 
-	if (madvise(ptr, size, MADV_DONTDUMP)) {
+#ifdef TARANTOOL_SMALL_HAVE_MADVISE
+static void
+madvise_advice(struct slab_arena_counters *counters, void *ptr, size_t size,
+	       int advice)
+{
+	pm_atomic_fetch_add(&counters->madvises, 1);
+	if (madvise(ptr, size, advice)) {
 		intptr_t ignore_it;
 		char buf[64];
 
@@ -61,18 +81,36 @@ madvise_checked(void *ptr, size_t size, int flags)
 		(void)ignore_it;
 
 		fprintf(stderr, "Error in madvise(%p, %zu, 0x%x): %s\n",
-			ptr, size, MADV_DONTDUMP, buf);
+			ptr, size, advice, buf);
 	}
-#else
-	(void)ptr;
+}
+#endif
+
+static void
+madvise_checked(struct slab_arena_counters *counters, void *ptr, size_t size,
+		int flags)
+{
+	if (!ptr)
+		return;
+#ifdef TARANTOOL_SMALL_USE_MADVISE
+	if (IS_SLAB_ARENA_FLAG(flags, SLAB_ARENA_DONTDUMP))
+		madvise_advice(counters, ptr, size, MADV_DONTDUMP);
+#endif
+#ifdef TARANTOOL_SMALL_USE_MADV_HUGEPAGE
+	/* hugetlb mappings are huge page backed anyway. */
+	if (IS_SLAB_ARENA_FLAG(flags, SLAB_ARENA_THP) &&
+	    !IS_SLAB_ARENA_FLAG(flags, SLAB_ARENA_HUGETLB))
+		madvise_advice(counters, ptr, size, MADV_HUGEPAGE);
+#endif
+	(void)counters;
 	(void)size;
 	(void)flags;
-#endif
 }
 
 static void
-munmap_checked(void *addr, size_t size)
+munmap_checked(struct slab_arena_counters *counters, void *addr, size_t size)
 {
+	pm_atomic_fetch_add(&counters->munmaps, 1);
 	if (munmap(addr, size)) {
 		char buf[64];
 		intptr_t ignore_it = (intptr_t)strerror_r(errno, buf,
@@ -85,29 +123,42 @@ munmap_checked(void *addr, size_t size)
 }
 
 static void *
-mmap_checked(size_t size, size_t align, int flags)
+mmap_checked(struct slab_arena_counters *counters, size_t size, size_t align,
+	     int flags)
 {
 	/* The alignment must be a power of two. */
 	assert((align & (align - 1)) == 0);
 	/* The size must be a multiple of alignment */
 	assert((size & (align - 1)) == 0);
 
-	if (IS_SLAB_ARENA_FLAG(flags, SLAB_ARENA_PRIVATE))
+	int arena_flags = flags;
+	int prot = PROT_READ | PROT_WRITE;
+	if (IS_SLAB_ARENA_FLAG(arena_flags, SLAB_ARENA_PRIVATE))
 		flags = MAP_PRIVATE | MAP_ANONYMOUS;
 	else
 		flags = MAP_SHARED | MAP_ANONYMOUS;
+#ifdef TARANTOOL_SMALL_HAVE_MAP_HUGETLB
+	if (IS_SLAB_ARENA_FLAG(arena_flags, SLAB_ARENA_HUGETLB))
+		flags |= MAP_HUGETLB;
+#endif
+	if (IS_SLAB_ARENA_FLAG(arena_flags, SLAB_ARENA_RESERVE)) {
+		/* Only reserve the address space. */
+		prot = PROT_NONE;
+		flags |= MAP_NORESERVE;
+	}
 
 	/*
 	 * All mappings except the first are likely to
 	 * be aligned already.  Be optimistic by trying
 	 * to map exactly the requested amount.
 	 */
-	void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+	pm_atomic_fetch_add(&counters->mmaps, 1);
+	void *map = mmap(NULL, size, prot, flags, -1, 0);
 	if (map == MAP_FAILED)
 		return NULL;
 	if (((intptr_t) map & (align - 1)) == 0)
 		return map;
-	munmap_checked(map, size);
+	munmap_checked(counters, map, size);
 
 	/*
 	 * mmap enough amount to be able to align
@@ -115,7 +166,8 @@ mmap_checked(size_t size, size_t align, int flags)
 	 * fragmentation depending on the kernels allocation
 	 * strategy.
 	 */
-	map = mmap(NULL, size + align, PROT_READ | PROT_WRITE, flags, -1, 0);
+	pm_atomic_fetch_add(&counters->mmaps, 1);
+	map = mmap(NULL, size + align, prot, flags, -1, 0);
 	if (map == MAP_FAILED)
 		return NULL;
 
@@ -124,16 +176,65 @@ mmap_checked(size_t size, size_t align, int flags)
 
 	if (offset != 0) {
 		/* Unmap unaligned prefix and postfix. */
-		munmap_checked(map, align - offset);
+		munmap_checked(counters, map, align - offset);
 		map += align - offset;
-		munmap_checked(map + size, offset);
+		munmap_checked(counters, map + size, offset);
 	} else {
 		/* The address is returned aligned. */
-		munmap_checked(map + size, align);
+		munmap_checked(counters, map + size, align);
 	}
 	return map;
 }
 
+/**
+ * Check that hugetlb mappings of the given size and alignment
+ * can be unmapped slab by slab: munmap() of a hugetlb mapping
+ * requires huge page aligned addresses and lengths.
+ */
+static bool
+hugetlb_is_compatible(size_t size, size_t align)
+{
+#ifdef TARANTOOL_SMALL_HAVE_MAP_HUGETLB
+	size_t huge_page_size = small_gethugepagesize();
+	return huge_page_size != 0 && size % huge_page_size == 0 &&
+	       align % huge_page_size == 0;
+#else
+	(void)size;
+	(void)align;
+	return false;
+#endif
+}
+
+/**
+ * Map memory for the arena honoring its backing flags. If the
+ * hugetlb pool is exhausted (or is not configured at all), fall
+ * back to regular pages and stop trying hugetlb for the rest of
+ * the arena life, so that the flags reflect the actual backing.
+ */
+static void *
+slab_arena_mmap(struct slab_arena *arena, size_t size)
+{
+	void *ptr = NULL;
+	int flags = pm_atomic_load(&arena->flags);
+	/* Slabs outside the reserved area are accessible at once. */
+	flags &= ~(SLAB_ARENA_RESERVE & ~SLAB_ARENA_FLAG_MARK);
+	if (IS_SLAB_ARENA_FLAG(flags, SLAB_ARENA_HUGETLB)) {
+		if (hugetlb_is_compatible(size, arena->slab_size))
+			ptr = mmap_checked(&arena->counters, size,
+					   arena->slab_size, flags);
+		if (ptr == NULL) {
+			int hugetlb = SLAB_ARENA_HUGETLB & ~SLAB_ARENA_FLAG_MARK;
+			flags &= ~hugetlb;
+			pm_atomic_fetch_and(&arena->flags, ~hugetlb);
+		}
+	}
+	if (ptr == NULL)
+		ptr = mmap_checked(&arena->counters, size, arena->slab_size,
+				   flags);
+	madvise_checked(&arena->counters, ptr, size, flags);
+	return ptr;
+}
+
 #if 0
 /** This is a way to round things up without using a built-in. */
 static size_t
@@ -152,6 +253,219 @@ pow2round(size_t size)
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
+/** Check if the kernel supports NUMA memory policies. */
+static bool
+numa_is_supported(void)
+{
+#ifdef TARANTOOL_SMALL_USE_NUMA
+	int mode;
+	return syscall(SYS_get_mempolicy, &mode, NULL, 0, NULL, 0) == 0;
+#else
+	return false;
+#endif
+}
+
+/** NUMA node of the CPU the calling thread runs on. */
+static unsigned
+numa_current_node(void)
+{
+#ifdef TARANTOOL_SMALL_USE_NUMA
+	unsigned cpu, node;
+	if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0)
+		return node;
+#endif
+	return 0;
+}
+
+/** NUMA node the memory at the given address resides on. */
+static unsigned
+numa_ptr_node(void *ptr)
+{
+#ifdef TARANTOOL_SMALL_USE_NUMA
+	int node;
+	if (syscall(SYS_get_mempolicy, &node, NULL, 0, ptr,
+		    MPOL_F_NODE | MPOL_F_ADDR) == 0)
+		return node;
+#else
+	(void)ptr;
+#endif
+	return 0;
+}
+
+/**
+ * Make the kernel allocate pages of a memory range on the given
+ * node. MPOL_PREFERRED rather than MPOL_BIND is used so that an
+ * exhausted node makes the kernel fall back to another one
+ * instead of invoking the OOM killer. Pages which have already
+ * been faulted in elsewhere (e.g. pre-faulted) are migrated.
+ */
+static void
+numa_bind(void *ptr, size_t size, unsigned node)
+{
+#ifdef TARANTOOL_SMALL_USE_NUMA
+	unsigned long nodemask;
+	if (node >= sizeof(nodemask) * CHAR_BIT)
+		return;
+	nodemask = 1UL << node;
+	if (syscall(SYS_mbind, ptr, size, MPOL_PREFERRED, &nodemask,
+		    sizeof(nodemask) * CHAR_BIT, MPOL_MF_MOVE) != 0) {
+		char buf[64];
+		intptr_t ignore_it = (intptr_t)strerror_r(errno, buf,
+							  sizeof(buf));
+		(void)ignore_it;
+		fprintf(stderr, "Error in mbind(%p, %zu, %u): %s\n",
+			ptr, size, node, buf);
+	}
+#else
+	(void)ptr;
+	(void)size;
+	(void)node;
+#endif
+}
+
+static inline bool
+slab_arena_is_numa(struct slab_arena *arena)
+{
+	return IS_SLAB_ARENA_FLAG(arena->flags, SLAB_ARENA_NUMA);
+}
+
+static inline struct slab_arena_node *
+slab_arena_node(struct slab_arena *arena, unsigned node)
+{
+	return &arena->nodes[node % SLAB_ARENA_NODE_MAX];
+}
+
+/**
+ * NUMA node a slab resides on. The node is recorded when the
+ * slab is mapped anew, only slabs mapped beyond the
+ * preallocated area need to ask the kernel.
+ */
+static inline unsigned
+slab_arena_slab_node(struct slab_arena *arena, void *ptr)
+{
+	if (ptr >= arena->arena && ptr < arena->arena + arena->prealloc) {
+		size_t i = ((char *)ptr - (char *)arena->arena) /
+			   arena->slab_size;
+		return arena->slab_nodes[i];
+	}
+	return numa_ptr_node(ptr);
+}
+
+/** Bind a slab to the given node and record it. */
+static inline void
+slab_arena_slab_bind(struct slab_arena *arena, void *ptr, unsigned node)
+{
+	numa_bind(ptr, arena->slab_size, node);
+	if (ptr >= arena->arena && ptr < arena->arena + arena->prealloc) {
+		size_t i = ((char *)ptr - (char *)arena->arena) /
+			   arena->slab_size;
+		arena->slab_nodes[i] = node % SLAB_ARENA_NODE_MAX;
+	}
+}
+
+/** Pop a slab from a cache list and account it. */
+static inline void *
+slab_arena_lifo_pop(struct slab_arena *arena, struct lf_lifo *cache)
+{
+	void *ptr = lf_lifo_pop(cache);
+	if (ptr != NULL)
+		pm_atomic_fetch_sub(&arena->cached, arena->slab_size);
+	return ptr;
+}
+
+/** The list of single cached slabs of the given node. */
+static inline struct lf_lifo *
+slab_arena_cache(struct slab_arena *arena, unsigned node)
+{
+	if (!slab_arena_is_numa(arena))
+		return &arena->cache;
+	return &slab_arena_node(arena, node)->cache;
+}
+
+/** The list of cached batches of slabs of the given node. */
+static inline struct lf_lifo *
+slab_arena_depot(struct slab_arena *arena, unsigned node)
+{
+	if (!slab_arena_is_numa(arena))
+		return &arena->depot;
+	return &slab_arena_node(arena, node)->depot;
+}
+
+/**
+ * A batch of cached slabs. Is stored in the first slab of
+ * the batch, so the rest of slabs are not touched while the
+ * batch is moved to or from a depot.
+ */
+struct slab_batch {
+	/** Link in a depot, must go first. */
+	struct lf_lifo link;
+	/** Number of slabs in the batch including this one. */
+	unsigned count;
+	/** The rest of slabs. */
+	void *slabs[SLAB_BATCH_MAX - 1];
+};
+
+/**
+ * Pop a single slab from a depot: take the last slab of the
+ * topmost batch and put the batch back.
+ */
+static void *
+slab_arena_depot_pop(struct slab_arena *arena, struct lf_lifo *depot)
+{
+	struct slab_batch *batch = lf_lifo_pop(depot);
+	if (batch == NULL)
+		return NULL;
+	pm_atomic_fetch_sub(&arena->cached, arena->slab_size);
+	if (batch->count == 1)
+		return batch;
+	void *ptr = batch->slabs[--batch->count - 1];
+	lf_lifo_push(depot, batch);
+	return ptr;
+}
+
+/** Pop a slab cached on the given node or NULL. */
+static inline void *
+slab_arena_cache_pop(struct slab_arena *arena, unsigned node)
+{
+	void *ptr = slab_arena_lifo_pop(arena, slab_arena_cache(arena, node));
+	if (ptr == NULL)
+		ptr = slab_arena_depot_pop(arena, slab_arena_depot(arena, node));
+	return ptr;
+}
+
+/** Cache a slab, on the node its memory resides on in NUMA mode. */
+static inline void
+slab_arena_cache_push(struct slab_arena *arena, void *ptr)
+{
+	struct lf_lifo *cache = &arena->cache;
+	if (slab_arena_is_numa(arena))
+		cache = &slab_arena_node(arena,
+					 slab_arena_slab_node(arena, ptr))->cache;
+	pm_atomic_fetch_add(&arena->cached, arena->slab_size);
+	lf_lifo_push(cache, ptr);
+}
+
+/**
+ * Take a slab from the cache of any node but the given one.
+ * Used only when no local memory can be obtained.
+ */
+static void *
+slab_arena_steal(struct slab_arena *arena, unsigned node)
+{
+	unsigned local = node % SLAB_ARENA_NODE_MAX;
+	for (unsigned i = 0; i < SLAB_ARENA_NODE_MAX; i++) {
+		if (i == local)
+			continue;
+		void *ptr = slab_arena_cache_pop(arena, i);
+		if (ptr != NULL) {
+			pm_atomic_fetch_add(&arena->nodes[local].steals, 1);
+			pm_atomic_fetch_add(&arena->counters.cache_hits, 1);
+			return ptr;
+		}
+	}
+	return NULL;
+}
+
 static void
 slab_arena_flags_init(struct slab_arena *arena, int flags)
 {
@@ -173,6 +487,10 @@ slab_arena_flags_init(struct slab_arena *arena, int flags)
 	       IS_SLAB_ARENA_FLAG(flags, SLAB_ARENA_SHARED));
 
 	arena->flags = flags;
+	if (slab_arena_is_numa(arena) && !numa_is_supported())
+		arena->flags &= ~(SLAB_ARENA_NUMA & ~SLAB_ARENA_FLAG_MARK);
+	if (IS_SLAB_ARENA_FLAG(arena->flags, SLAB_ARENA_RESERVE))
+		arena->flags &= ~(SLAB_ARENA_HUGETLB & ~SLAB_ARENA_FLAG_MARK);
 }
 
 int
@@ -181,6 +499,22 @@ slab_arena_create(struct slab_arena *arena, struct quota *quota,
 {
 	lf_lifo_init(&arena->cache);
 	VALGRIND_MAKE_MEM_DEFINED(&arena->cache, sizeof(struct lf_lifo));
+	lf_lifo_init(&arena->depot);
+	VALGRIND_MAKE_MEM_DEFINED(&arena->depot, sizeof(struct lf_lifo));
+	lf_lifo_init(&arena->trimmed);
+	VALGRIND_MAKE_MEM_DEFINED(&arena->trimmed, sizeof(struct lf_lifo));
+	arena->cached = 0;
+	for (unsigned i = 0; i < SLAB_ARENA_NODE_MAX; i++) {
+		struct slab_arena_node *node = &arena->nodes[i];
+		lf_lifo_init(&node->cache);
+		VALGRIND_MAKE_MEM_DEFINED(&node->cache,
+					  sizeof(struct lf_lifo));
+		lf_lifo_init(&node->depot);
+		VALGRIND_MAKE_MEM_DEFINED(&node->depot,
+					  sizeof(struct lf_lifo));
+		node->used = 0;
+		node->steals = 0;
+	}
 
 	/*
 	 * Round up the user supplied data - it can come in
@@ -198,70 +532,682 @@ slab_arena_create(struct slab_arena *arena, struct quota *quota,
 	arena->prealloc = small_align(prealloc, arena->slab_size);
 
 	arena->used = 0;
+	arena->committed = 0;
+	arena->prefaulted = 0;
+	memset(&arena->counters, 0, sizeof(arena->counters));
+	arena->prefaulter = NULL;
+	arena->header = NULL;
+	arena->slab_nodes = NULL;
 
 	slab_arena_flags_init(arena, flags);
 
-	if (arena->prealloc) {
-		arena->arena = mmap_checked(arena->prealloc,
-					    arena->slab_size,
-					    arena->flags);
-	} else {
+	if (slab_arena_is_numa(arena) && arena->prealloc != 0) {
+		arena->slab_nodes = calloc(arena->prealloc / arena->slab_size,
+					   sizeof(*arena->slab_nodes));
+		if (arena->slab_nodes == NULL)
+			return -1;
+	}
+
+	if (arena->prealloc == 0) {
 		arena->arena = NULL;
+	} else if (IS_SLAB_ARENA_FLAG(arena->flags, SLAB_ARENA_RESERVE)) {
+		arena->arena = mmap_checked(&arena->counters, arena->prealloc,
+					    arena->slab_size, arena->flags);
+		madvise_checked(&arena->counters, arena->arena,
+				arena->prealloc, arena->flags);
+	} else {
+		arena->arena = slab_arena_mmap(arena, arena->prealloc);
+		arena->committed = arena->prealloc;
 	}
 
-	madvise_checked(arena->arena, arena->prealloc, arena->flags);
+	if (arena->prealloc && !arena->arena) {
+		free(arena->slab_nodes);
+		arena->slab_nodes = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Header of a file backing an arena. Occupies the first page
+ * of the file, slabs follow it. All fields are fixed size to
+ * keep the format independent of the build.
+ */
+struct slab_arena_file_header {
+	/** SLAB_ARENA_FILE_MAGIC once the file is initialized. */
+	uint64_t magic;
+	uint32_t version;
+	uint32_t slab_size;
+	uint64_t prealloc;
+	/** The address slabs are mapped at. */
+	uint64_t base;
+	/** slab_arena::used. */
+	uint64_t used;
+	/** slab_arena::cached. */
+	uint64_t cached;
+	/** Heads of slab_arena lists, with ABA counters. */
+	uint64_t cache;
+	uint64_t depot;
+	uint64_t trimmed;
+};
 
-	return arena->prealloc && !arena->arena ? -1 : 0;
+/** "SMALLARN" */
+#define SLAB_ARENA_FILE_MAGIC 0x534d414c4c41524eULL
+#define SLAB_ARENA_FILE_VERSION 1
+
+/** Map a range of an arena file and account the call. */
+static void *
+mmap_file_checked(struct slab_arena_counters *counters, void *addr,
+		  size_t size, int flags, int fd, off_t offset)
+{
+	pm_atomic_fetch_add(&counters->mmaps, 1);
+	void *map = mmap(addr, size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | flags, fd, offset);
+	return map == MAP_FAILED ? NULL : map;
 }
 
-void
-slab_arena_destroy(struct slab_arena *arena)
+/** Check that a pointer read from the file is a slab of the arena. */
+static inline bool
+slab_arena_file_has_slab(struct slab_arena *arena, void *ptr)
+{
+	return ptr >= arena->arena && ptr < arena->arena + arena->prealloc &&
+	       ((uintptr_t)ptr & (arena->slab_size - 1)) == 0;
+}
+
+/**
+ * Count slabs in a list restored from the file, checking that
+ * all of them are slabs of the arena, so that a corrupted file
+ * can't make the arena hand out wild pointers. Elements of a
+ * depot are batches of slabs.
+ *
+ * @retval true the list is valid, @a count is set
+ * @retval false the list is corrupted
+ */
+static bool
+slab_arena_file_check_lifo(struct slab_arena *arena, struct lf_lifo *head,
+			   bool is_depot, size_t *count)
+{
+	/* A longer list must have a cycle. */
+	size_t max = arena->prealloc / arena->slab_size;
+	size_t n = 0;
+	for (struct lf_lifo *elem = lf_lifo(head->next); elem != NULL;
+	     elem = lf_lifo(elem->next)) {
+		if (!slab_arena_file_has_slab(arena, elem))
+			return false;
+		if (!is_depot) {
+			n++;
+		} else {
+			struct slab_batch *batch = (struct slab_batch *)elem;
+			if (batch->count == 0 || batch->count > SLAB_BATCH_MAX)
+				return false;
+			for (unsigned i = 0; i < batch->count - 1; i++) {
+				if (!slab_arena_file_has_slab(arena,
+							      batch->slabs[i]))
+					return false;
+			}
+			n += batch->count;
+		}
+		if (n > max)
+			return false;
+	}
+	*count = n;
+	return true;
+}
+
+/**
+ * Map slabs of an initialized file back at the recorded
+ * address and restore the arena state. The header and the
+ * lists are checked against the file, so that a truncated or
+ * corrupted file fails with EINVAL instead of a crash.
+ */
+static int
+slab_arena_file_restore(struct slab_arena *arena, int fd)
+{
+	struct slab_arena_file_header *header = arena->header;
+	size_t page_size = small_getpagesize();
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+		return -1;
+	if (header->version != SLAB_ARENA_FILE_VERSION ||
+	    header->slab_size != arena->slab_size ||
+	    header->prealloc % arena->slab_size != 0 ||
+	    header->base % arena->slab_size != 0 ||
+	    header->prealloc > SIZE_MAX - page_size ||
+	    (uint64_t)st.st_size < page_size + header->prealloc ||
+	    header->used > header->prealloc ||
+	    header->used % arena->slab_size != 0 ||
+	    header->cached > header->used) {
+		errno = EINVAL;
+		return -1;
+	}
+	int flags = 0;
+#ifdef MAP_FIXED_NOREPLACE
+	flags |= MAP_FIXED_NOREPLACE;
+#endif
+	void *base = (void *)(uintptr_t)header->base;
+	void *map = mmap_file_checked(&arena->counters, base,
+				      header->prealloc, flags, fd, page_size);
+	if (map == NULL)
+		return -1;
+	if (map != base) {
+		munmap_checked(&arena->counters, map, header->prealloc);
+		errno = EADDRNOTAVAIL;
+		return -1;
+	}
+	arena->arena = map;
+	arena->prealloc = header->prealloc;
+	arena->committed = header->prealloc;
+	arena->used = header->used;
+	arena->cached = header->cached;
+	arena->cache.next = (void *)(uintptr_t)header->cache;
+	arena->depot.next = (void *)(uintptr_t)header->depot;
+	arena->trimmed.next = (void *)(uintptr_t)header->trimmed;
+	size_t cached, batched, trimmed;
+	if (!slab_arena_file_check_lifo(arena, &arena->cache, false,
+					&cached) ||
+	    !slab_arena_file_check_lifo(arena, &arena->depot, true,
+					&batched) ||
+	    !slab_arena_file_check_lifo(arena, &arena->trimmed, false,
+					&trimmed) ||
+	    (cached + batched) * arena->slab_size != arena->cached ||
+	    arena->cached + trimmed * arena->slab_size > arena->used) {
+		errno = EINVAL;
+		goto fail;
+	}
+	/* Memory of trimmed slabs is not billed to the quota. */
+	if (quota_use(arena->quota,
+		      arena->used - trimmed * arena->slab_size) < 0) {
+		errno = ENOMEM;
+		goto fail;
+	}
+	arena->counters.peak_used = arena->used;
+	return 0;
+fail:
+	munmap_checked(&arena->counters, map, header->prealloc);
+	arena->arena = NULL;
+	lf_lifo_init(&arena->cache);
+	lf_lifo_init(&arena->depot);
+	lf_lifo_init(&arena->trimmed);
+	arena->prealloc = arena->committed = arena->used = arena->cached = 0;
+	return -1;
+}
+
+/** Extend a new file to fit the slabs, map and initialize it. */
+static int
+slab_arena_file_init(struct slab_arena *arena, int fd, size_t prealloc)
+{
+	size_t page_size = small_getpagesize();
+	prealloc = MIN(prealloc, quota_total(arena->quota));
+	prealloc = small_align(prealloc, arena->slab_size);
+	if (prealloc == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (ftruncate(fd, page_size + prealloc) != 0)
+		return -1;
+	/* Reserve an aligned address range and map the file over it. */
+	void *map = mmap_checked(&arena->counters, prealloc,
+				 arena->slab_size, arena->flags);
+	if (map == NULL)
+		return -1;
+	if (mmap_file_checked(&arena->counters, map, prealloc, MAP_FIXED,
+			      fd, page_size) == NULL) {
+		munmap_checked(&arena->counters, map, prealloc);
+		return -1;
+	}
+	arena->arena = map;
+	arena->prealloc = prealloc;
+	arena->committed = prealloc;
+
+	struct slab_arena_file_header *header = arena->header;
+	memset(header, 0, sizeof(*header));
+	header->version = SLAB_ARENA_FILE_VERSION;
+	header->slab_size = arena->slab_size;
+	header->prealloc = prealloc;
+	header->base = (uintptr_t)map;
+	/* Set the magic last: the header is valid from now on. */
+	header->magic = SLAB_ARENA_FILE_MAGIC;
+	return 0;
+}
+
+int
+slab_arena_create_file(struct slab_arena *arena, struct quota *quota,
+		       int fd, size_t prealloc, uint32_t slab_size,
+		       int flags)
+{
+	assert(flags & SLAB_ARENA_FLAG_MARK);
+	flags &= ~((SLAB_ARENA_PRIVATE | SLAB_ARENA_NUMA |
+		    SLAB_ARENA_HUGETLB | SLAB_ARENA_RESERVE) &
+		   ~SLAB_ARENA_FLAG_MARK);
+	flags |= SLAB_ARENA_SHARED;
+	if (slab_arena_create(arena, quota, 0, slab_size, flags) != 0)
+		return -1;
+
+	size_t page_size = small_getpagesize();
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+		return -1;
+	if ((size_t)st.st_size < page_size &&
+	    ftruncate(fd, page_size) != 0)
+		return -1;
+	void *header = mmap_file_checked(&arena->counters, NULL, page_size,
+					 0, fd, 0);
+	if (header == NULL)
+		return -1;
+	arena->header = header;
+
+	int rc;
+	if (arena->header->magic == SLAB_ARENA_FILE_MAGIC)
+		rc = slab_arena_file_restore(arena, fd);
+	else
+		rc = slab_arena_file_init(arena, fd, prealloc);
+	if (rc != 0) {
+		int save_errno = errno;
+		munmap_checked(&arena->counters, header, page_size);
+		arena->header = NULL;
+		errno = save_errno;
+		return -1;
+	}
+	madvise_checked(&arena->counters, arena->arena, arena->prealloc,
+			arena->flags);
+	return 0;
+}
+
+int
+slab_arena_sync(struct slab_arena *arena)
+{
+	struct slab_arena_file_header *header = arena->header;
+	assert(header != NULL);
+	header->used = MIN(pm_atomic_load(&arena->used), arena->prealloc);
+	header->cached = pm_atomic_load(&arena->cached);
+	header->cache = (uintptr_t)pm_atomic_load(&arena->cache.next);
+	header->depot = (uintptr_t)pm_atomic_load(&arena->depot.next);
+	header->trimmed = (uintptr_t)pm_atomic_load(&arena->trimmed.next);
+	/* Flush the slabs first, so the header never gets ahead. */
+	if (msync(arena->arena, arena->prealloc, MS_SYNC) != 0 ||
+	    msync(header, small_getpagesize(), MS_SYNC) != 0)
+		return -1;
+	return 0;
+}
+
+/** Unmap a cached slab unless it belongs to the preallocated area. */
+static void
+slab_arena_unmap_cached(struct slab_arena *arena, void *ptr)
+{
+	if (arena->arena == NULL || ptr < arena->arena ||
+	    ptr >= arena->arena + arena->prealloc)
+		munmap_checked(&arena->counters, ptr, arena->slab_size);
+}
+
+/** Unmap all slabs of a cache, return their total size. */
+static size_t
+slab_arena_cache_destroy(struct slab_arena *arena, struct lf_lifo *cache)
 {
 	void *ptr;
 	size_t total = 0;
-	while ((ptr = lf_lifo_pop(&arena->cache))) {
-		if (arena->arena == NULL || ptr < arena->arena ||
-		    ptr >= arena->arena + arena->prealloc) {
-			munmap_checked(ptr, arena->slab_size);
-		}
+	while ((ptr = lf_lifo_pop(cache))) {
+		slab_arena_unmap_cached(arena, ptr);
 		total += arena->slab_size;
 	}
+	return total;
+}
+
+/** Unmap all slabs of a depot, return their total size. */
+static size_t
+slab_arena_depot_destroy(struct slab_arena *arena, struct lf_lifo *depot)
+{
+	struct slab_batch *batch;
+	size_t total = 0;
+	while ((batch = lf_lifo_pop(depot))) {
+		for (unsigned i = 0; i < batch->count - 1; i++)
+			slab_arena_unmap_cached(arena, batch->slabs[i]);
+		total += batch->count * arena->slab_size;
+		slab_arena_unmap_cached(arena, batch);
+	}
+	return total;
+}
+
+void
+slab_arena_destroy(struct slab_arena *arena)
+{
+	slab_arena_prefault_stop(arena);
+	if (arena->header != NULL) {
+		/* All slabs are in the file, keep them there. */
+		slab_arena_sync(arena);
+		munmap_checked(&arena->counters, arena->arena, arena->prealloc);
+		munmap_checked(&arena->counters, arena->header,
+			       small_getpagesize());
+		return;
+	}
+	size_t total = slab_arena_cache_destroy(arena, &arena->cache);
+	total += slab_arena_depot_destroy(arena, &arena->depot);
+	total += slab_arena_cache_destroy(arena, &arena->trimmed);
+	for (unsigned i = 0; i < SLAB_ARENA_NODE_MAX; i++) {
+		struct slab_arena_node *node = &arena->nodes[i];
+		total += slab_arena_cache_destroy(arena, &node->cache);
+		total += slab_arena_depot_destroy(arena, &node->depot);
+	}
 	if (arena->arena)
-		munmap_checked(arena->arena, arena->prealloc);
+		munmap_checked(&arena->counters, arena->arena, arena->prealloc);
+	free(arena->slab_nodes);
 
 	(void)total;
 	assert(total == arena->used);
 }
 
-void *
-slab_map(struct slab_arena *arena)
+/**
+ * State of the thread pre-faulting the preallocated area,
+ * see slab_arena_prefault_start().
+ */
+struct slab_arena_prefaulter {
+	struct slab_arena *arena;
+	/** How many slabs to keep pre-faulted. */
+	size_t ahead;
+	/** NUMA node of the thread which started pre-faulting. */
+	unsigned node;
+	/** Set to make the thread exit. */
+	bool stop;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t thread;
+};
+
+enum {
+	/**
+	 * How often the pre-faulting thread checks the arena
+	 * if it is not woken up, in milliseconds. Wakeups are
+	 * sent without taking the mutex and may be missed.
+	 */
+	SLAB_ARENA_PREFAULT_PERIOD = 10,
+};
+
+/**
+ * Make the kernel populate page tables of a memory range
+ * without changing its contents.
+ */
+static void
+slab_arena_populate(struct slab_arena *arena, void *ptr, size_t size)
 {
-	void *ptr;
-	if ((ptr = lf_lifo_pop(&arena->cache))) {
-		VALGRIND_MAKE_MEM_UNDEFINED(ptr, arena->slab_size);
-		return ptr;
+#if defined(TARANTOOL_SMALL_HAVE_MADVISE) && \
+    defined(TARANTOOL_SMALL_HAVE_MADV_POPULATE_WRITE)
+	pm_atomic_fetch_add(&arena->counters.madvises, 1);
+	if (madvise(ptr, size, MADV_POPULATE_WRITE) == 0)
+		return;
+#else
+	(void)arena;
+#endif
+	/*
+	 * The slab may be handed out concurrently, so do an
+	 * atomic no-op write rather than a plain store.
+	 */
+	size_t page_size = small_getpagesize();
+	for (char *page = ptr; page < (char *)ptr + size; page += page_size)
+		pm_atomic_fetch_add((long *)page, 0);
+}
+
+/**
+ * Make the preallocated area accessible up to offset @a end.
+ * In SLAB_ARENA_RESERVE mode memory is committed in chunks of
+ * SLAB_ARENA_COMMIT_CHUNK slabs to amortize mprotect() calls.
+ * Concurrent calls may commit the same range twice, which is
+ * harmless.
+ */
+static bool
+slab_arena_commit(struct slab_arena *arena, size_t end)
+{
+	size_t committed = pm_atomic_load(&arena->committed);
+	if (end <= committed)
+		return true;
+	size_t chunk = (size_t)SLAB_ARENA_COMMIT_CHUNK * arena->slab_size;
+	end = MIN(small_align(end, chunk), arena->prealloc);
+	pm_atomic_fetch_add(&arena->counters.mprotects, 1);
+	if (mprotect((char *)arena->arena + committed, end - committed,
+		     PROT_READ | PROT_WRITE) != 0)
+		return false;
+	while (committed < end &&
+	       !pm_atomic_compare_exchange_weak(&arena->committed,
+						&committed, end));
+	return true;
+}
+
+/**
+ * Pre-fault up to @a count slabs following arena->used. In
+ * NUMA mode the slabs are bound to @a node first, so that their
+ * pages are allocated on the node which is going to use them.
+ */
+static size_t
+slab_arena_prefault_node(struct slab_arena *arena, size_t count,
+			 unsigned node)
+{
+	size_t used = MIN(pm_atomic_load(&arena->used), arena->prealloc);
+	size_t offset = MAX(pm_atomic_load(&arena->prefaulted), used);
+	size_t end = arena->prealloc;
+	if (count < (end - used) / arena->slab_size)
+		end = used + count * arena->slab_size;
+	size_t done = 0;
+	if (offset < end && !slab_arena_commit(arena, end))
+		return 0;
+	for (; offset < end; offset += arena->slab_size) {
+		if (slab_arena_is_numa(arena))
+			numa_bind((char *)arena->arena + offset,
+				  arena->slab_size, node);
+		slab_arena_populate(arena, (char *)arena->arena + offset,
+				    arena->slab_size);
+		done++;
+		/* Advance the watermark, it can only grow. */
+		size_t prefaulted = pm_atomic_load(&arena->prefaulted);
+		while (prefaulted < offset + arena->slab_size &&
+		       !pm_atomic_compare_exchange_weak(&arena->prefaulted,
+						&prefaulted,
+						offset + arena->slab_size));
+	}
+	return done;
+}
+
+size_t
+slab_arena_prefault(struct slab_arena *arena, size_t count)
+{
+	unsigned node = 0;
+	if (slab_arena_is_numa(arena))
+		node = numa_current_node();
+	return slab_arena_prefault_node(arena, count, node);
+}
+
+static void *
+slab_arena_prefault_f(void *arg)
+{
+	struct slab_arena_prefaulter *prefaulter = arg;
+	struct slab_arena *arena = prefaulter->arena;
+	pthread_mutex_lock(&prefaulter->mutex);
+	while (!prefaulter->stop) {
+		pthread_mutex_unlock(&prefaulter->mutex);
+		slab_arena_prefault_node(arena, prefaulter->ahead,
+					 prefaulter->node);
+		pthread_mutex_lock(&prefaulter->mutex);
+		if (prefaulter->stop ||
+		    pm_atomic_load(&arena->prefaulted) == arena->prealloc)
+			break;
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += SLAB_ARENA_PREFAULT_PERIOD * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&prefaulter->cond, &prefaulter->mutex,
+				       &deadline);
+	}
+	pthread_mutex_unlock(&prefaulter->mutex);
+	return NULL;
+}
+
+int
+slab_arena_prefault_start(struct slab_arena *arena, size_t ahead)
+{
+	assert(arena->prefaulter == NULL);
+	struct slab_arena_prefaulter *prefaulter =
+		malloc(sizeof(*prefaulter));
+	if (prefaulter == NULL)
+		return -1;
+	prefaulter->arena = arena;
+	prefaulter->ahead = ahead;
+	prefaulter->node = 0;
+	if (slab_arena_is_numa(arena))
+		prefaulter->node = numa_current_node();
+	prefaulter->stop = false;
+	pthread_mutex_init(&prefaulter->mutex, NULL);
+	pthread_cond_init(&prefaulter->cond, NULL);
+	if (pthread_create(&prefaulter->thread, NULL,
+			   slab_arena_prefault_f, prefaulter) != 0) {
+		pthread_cond_destroy(&prefaulter->cond);
+		pthread_mutex_destroy(&prefaulter->mutex);
+		free(prefaulter);
+		return -1;
 	}
+	pm_atomic_store(&arena->prefaulter, prefaulter);
+	return 0;
+}
 
-	if (quota_use(arena->quota, arena->slab_size) < 0)
+void
+slab_arena_prefault_stop(struct slab_arena *arena)
+{
+	struct slab_arena_prefaulter *prefaulter = arena->prefaulter;
+	if (prefaulter == NULL)
+		return;
+	arena->prefaulter = NULL;
+	pthread_mutex_lock(&prefaulter->mutex);
+	prefaulter->stop = true;
+	pthread_cond_signal(&prefaulter->cond);
+	pthread_mutex_unlock(&prefaulter->mutex);
+	pthread_join(prefaulter->thread, NULL);
+	pthread_cond_destroy(&prefaulter->cond);
+	pthread_mutex_destroy(&prefaulter->mutex);
+	free(prefaulter);
+}
+
+/**
+ * Account a fresh slab ending at offset @a used of the
+ * preallocated area and wake up the pre-faulting thread if
+ * the pre-faulted margin has fallen below a half.
+ */
+static inline void
+slab_arena_prefault_account(struct slab_arena *arena, size_t used)
+{
+	size_t prefaulted = pm_atomic_load(&arena->prefaulted);
+	if (used <= prefaulted)
+		pm_atomic_fetch_add(&arena->counters.prefault_hits, 1);
+	else
+		pm_atomic_fetch_add(&arena->counters.prefault_misses, 1);
+	struct slab_arena_prefaulter *prefaulter =
+		pm_atomic_load(&arena->prefaulter);
+	if (prefaulter != NULL && prefaulted < arena->prealloc &&
+	    prefaulted < used + prefaulter->ahead / 2 * arena->slab_size)
+		pthread_cond_signal(&prefaulter->cond);
+}
+
+/** Update the peak of arena->used. */
+static inline void
+slab_arena_account_used(struct slab_arena *arena, size_t used)
+{
+	size_t peak = pm_atomic_load(&arena->counters.peak_used);
+	while (peak < used &&
+	       !pm_atomic_compare_exchange_weak(&arena->counters.peak_used,
+						&peak, used));
+}
+
+/** Get a never used slab from the preallocated area or mmap() it. */
+static void *
+slab_arena_map_new(struct slab_arena *arena)
+{
+	if (quota_use(arena->quota, arena->slab_size) < 0) {
+		pm_atomic_fetch_add(&arena->counters.quota_refusals, 1);
 		return NULL;
+	}
 
-	/** Need to allocate a new slab. */
-	size_t used = pm_atomic_fetch_add(&arena->used, arena->slab_size);
-	used += arena->slab_size;
-	if (used <= arena->prealloc) {
-		ptr = arena->arena + used - arena->slab_size;
-		VALGRIND_MAKE_MEM_UNDEFINED(ptr, arena->slab_size);
-		return ptr;
+	/*
+	 * Claim a slab of the preallocated area. The bump pointer
+	 * can't be rolled back on failure, other threads may have
+	 * advanced it already, so in SLAB_ARENA_RESERVE mode the
+	 * slab is committed before it is claimed.
+	 */
+	size_t used = pm_atomic_load(&arena->used);
+	while (used + arena->slab_size <= arena->prealloc) {
+		if (IS_SLAB_ARENA_FLAG(arena->flags, SLAB_ARENA_RESERVE) &&
+		    !slab_arena_commit(arena, used + arena->slab_size)) {
+			quota_release(arena->quota, arena->slab_size);
+			return NULL;
+		}
+		if (pm_atomic_compare_exchange_weak(&arena->used, &used,
+						    used + arena->slab_size)) {
+			used += arena->slab_size;
+			slab_arena_account_used(arena, used);
+			slab_arena_prefault_account(arena, used);
+			return arena->arena + used - arena->slab_size;
+		}
 	}
 
-	ptr = mmap_checked(arena->slab_size, arena->slab_size,
-			   arena->flags);
-	if (!ptr) {
-		__sync_sub_and_fetch(&arena->used, arena->slab_size);
+	/*
+	 * A file backed arena can't grow beyond the file. Account
+	 * a slab mmap()ed beyond the preallocated area only once
+	 * it has been obtained, so arena->used never overshoots.
+	 */
+	void *ptr = NULL;
+	if (arena->header == NULL)
+		ptr = slab_arena_mmap(arena, arena->slab_size);
+	if (ptr == NULL) {
 		quota_release(arena->quota, arena->slab_size);
+		return NULL;
 	}
+	used = pm_atomic_fetch_add(&arena->used, arena->slab_size);
+	slab_arena_account_used(arena, used + arena->slab_size);
+	return ptr;
+}
+
+/** Reuse a slab which memory has been returned to the OS. */
+static void *
+slab_arena_map_trimmed(struct slab_arena *arena)
+{
+	if (lf_lifo_is_empty(&arena->trimmed))
+		return NULL;
+	if (quota_use(arena->quota, arena->slab_size) < 0) {
+		pm_atomic_fetch_add(&arena->counters.quota_refusals, 1);
+		return NULL;
+	}
+	void *ptr = lf_lifo_pop(&arena->trimmed);
+	if (ptr == NULL)
+		quota_release(arena->quota, arena->slab_size);
+	return ptr;
+}
 
-	madvise_checked(ptr, arena->slab_size, arena->flags);
+void *
+slab_map(struct slab_arena *arena)
+{
+	unsigned node = 0;
+	if (slab_arena_is_numa(arena))
+		node = numa_current_node();
+
+	void *ptr;
+	if ((ptr = slab_arena_cache_pop(arena, node))) {
+		pm_atomic_fetch_add(&arena->counters.cache_hits, 1);
+		VALGRIND_MAKE_MEM_UNDEFINED(ptr, arena->slab_size);
+		return ptr;
+	}
+
+	/** Need to allocate a new slab. */
+	ptr = slab_arena_map_trimmed(arena);
+	if (ptr == NULL)
+		ptr = slab_arena_map_new(arena);
+	if (ptr != NULL)
+		pm_atomic_fetch_add(&arena->counters.fresh_maps, 1);
+	if (slab_arena_is_numa(arena)) {
+		if (ptr != NULL) {
+			slab_arena_slab_bind(arena, ptr, node);
+			pm_atomic_fetch_add(&slab_arena_node(arena, node)->used,
+					    arena->slab_size);
+		} else {
+			ptr = slab_arena_steal(arena, node);
+		}
+	}
 
 	VALGRIND_MAKE_MEM_UNDEFINED(ptr, arena->slab_size);
 	return ptr;
@@ -273,14 +1219,244 @@ slab_unmap(struct slab_arena *arena, void *ptr)
 	if (ptr == NULL)
 		return;
 
-	lf_lifo_push(&arena->cache, ptr);
+	slab_arena_cache_push(arena, ptr);
 	VALGRIND_MAKE_MEM_NOACCESS(ptr, arena->slab_size);
 	VALGRIND_MAKE_MEM_DEFINED(lf_lifo(ptr), sizeof(struct lf_lifo));
 }
 
+unsigned
+slab_map_batch(struct slab_arena *arena, void **slabs, unsigned count)
+{
+	assert(count <= SLAB_BATCH_MAX);
+	unsigned node = 0;
+	if (slab_arena_is_numa(arena))
+		node = numa_current_node();
+
+	unsigned n = 0;
+	struct lf_lifo *depot = slab_arena_depot(arena, node);
+	struct slab_batch *batch = lf_lifo_pop(depot);
+	if (batch != NULL) {
+		n = MIN(count, batch->count);
+		pm_atomic_fetch_sub(&arena->cached, n * arena->slab_size);
+		if (n < batch->count) {
+			/* Take the tail, put the rest back. */
+			batch->count -= n;
+			memcpy(slabs, batch->slabs + batch->count - 1,
+			       n * sizeof(*slabs));
+			lf_lifo_push(depot, batch);
+		} else {
+			slabs[0] = batch;
+			memcpy(slabs + 1, batch->slabs,
+			       (n - 1) * sizeof(*slabs));
+		}
+	}
+	struct lf_lifo *cache = slab_arena_cache(arena, node);
+	void *ptr;
+	while (n < count && (ptr = slab_arena_lifo_pop(arena, cache)))
+		slabs[n++] = ptr;
+	if (n > 0)
+		pm_atomic_fetch_add(&arena->counters.cache_hits, n);
+	if (n == 0 && (ptr = slab_map(arena)) != NULL)
+		slabs[n++] = ptr;
+	for (unsigned i = 0; i < n; i++)
+		VALGRIND_MAKE_MEM_UNDEFINED(slabs[i], arena->slab_size);
+	return n;
+}
+
+void
+slab_unmap_batch(struct slab_arena *arena, void **slabs, unsigned count)
+{
+	assert(count <= SLAB_BATCH_MAX);
+	if (count == 0)
+		return;
+	struct lf_lifo *depot = &arena->depot;
+	void *local[SLAB_BATCH_MAX];
+	if (slab_arena_is_numa(arena)) {
+		/*
+		 * A batch is popped as a whole by the node whose
+		 * depot it is on, so it must only hold slabs of
+		 * that node. Slabs of other nodes go to their
+		 * node caches one by one.
+		 */
+		unsigned node = slab_arena_slab_node(arena, slabs[0]);
+		unsigned n = 0;
+		for (unsigned i = 0; i < count; i++) {
+			void *ptr = slabs[i];
+			if (slab_arena_slab_node(arena, ptr) == node) {
+				local[n++] = ptr;
+				continue;
+			}
+			slab_arena_cache_push(arena, ptr);
+			VALGRIND_MAKE_MEM_NOACCESS(ptr, arena->slab_size);
+			VALGRIND_MAKE_MEM_DEFINED(lf_lifo(ptr),
+						  sizeof(struct lf_lifo));
+		}
+		depot = &slab_arena_node(arena, node)->depot;
+		slabs = local;
+		count = n;
+	}
+	struct slab_batch *batch = slabs[0];
+	batch->count = count;
+	memcpy(batch->slabs, slabs + 1, (count - 1) * sizeof(*slabs));
+
+	pm_atomic_fetch_add(&arena->cached, count * arena->slab_size);
+	lf_lifo_push(depot, batch);
+	for (unsigned i = 0; i < count; i++)
+		VALGRIND_MAKE_MEM_NOACCESS(slabs[i], arena->slab_size);
+	VALGRIND_MAKE_MEM_DEFINED(batch, sizeof(*batch));
+}
+
+void
+slab_magazine_create(struct slab_magazine *mag, struct slab_arena *arena,
+		     unsigned size)
+{
+	assert(size >= 2 && size <= SLAB_MAGAZINE_SIZE_MAX);
+	mag->arena = arena;
+	mag->size = size;
+	mag->count = 0;
+}
+
+void
+slab_magazine_flush(struct slab_magazine *mag)
+{
+	unsigned i = 0;
+	while (i < mag->count) {
+		unsigned n = MIN(mag->count - i, (unsigned)SLAB_BATCH_MAX);
+		slab_unmap_batch(mag->arena, mag->slabs + i, n);
+		i += n;
+	}
+	mag->count = 0;
+}
+
+void *
+slab_magazine_map(struct slab_magazine *mag)
+{
+	if (mag->count == 0) {
+		mag->count = slab_map_batch(mag->arena, mag->slabs,
+					    mag->size / 2);
+		if (mag->count == 0)
+			return NULL;
+	}
+	void *ptr = mag->slabs[--mag->count];
+	VALGRIND_MAKE_MEM_UNDEFINED(ptr, mag->arena->slab_size);
+	return ptr;
+}
+
+void
+slab_magazine_unmap(struct slab_magazine *mag, void *ptr)
+{
+	if (ptr == NULL)
+		return;
+	if (mag->count == mag->size) {
+		/* Flush the least recently unmapped half. */
+		unsigned n = mag->size / 2;
+		slab_unmap_batch(mag->arena, mag->slabs, n);
+		mag->count -= n;
+		memmove(mag->slabs, mag->slabs + n,
+			mag->count * sizeof(*mag->slabs));
+	}
+	mag->slabs[mag->count++] = ptr;
+	VALGRIND_MAKE_MEM_NOACCESS(ptr, mag->arena->slab_size);
+}
+
+/**
+ * Return the memory of a slab to the OS. Anonymous shared
+ * memory is backed by shmem, MADV_DONTNEED would only unmap
+ * its pages there, so MADV_REMOVE is used to free them.
+ */
+static bool
+slab_arena_release(struct slab_arena *arena, void *ptr)
+{
+#ifdef TARANTOOL_SMALL_HAVE_MADVISE
+	int advice = MADV_DONTNEED;
+#ifdef TARANTOOL_SMALL_HAVE_MADV_REMOVE
+	if (IS_SLAB_ARENA_FLAG(arena->flags, SLAB_ARENA_SHARED))
+		advice = MADV_REMOVE;
+#endif
+	pm_atomic_fetch_add(&arena->counters.madvises, 1);
+	return madvise(ptr, arena->slab_size, advice) == 0;
+#else
+	(void)arena;
+	(void)ptr;
+	return false;
+#endif
+}
+
+size_t
+slab_arena_trim_step(struct slab_arena *arena, size_t keep, size_t max)
+{
+	size_t released = 0;
+	unsigned node = 0;
+	unsigned empty = 0;
+	while (released + arena->slab_size <= max &&
+	       pm_atomic_load(&arena->cached) >= keep + arena->slab_size) {
+		/* Go round robin through nodes in NUMA mode. */
+		struct slab_arena_node *from = slab_arena_node(arena, node);
+		void *ptr = slab_arena_cache_pop(arena, node);
+		if (slab_arena_is_numa(arena))
+			node = (node + 1) % SLAB_ARENA_NODE_MAX;
+		if (ptr == NULL) {
+			/* The cache is being used concurrently. */
+			if (!slab_arena_is_numa(arena) ||
+			    ++empty == SLAB_ARENA_NODE_MAX)
+				break;
+			continue;
+		}
+		empty = 0;
+		VALGRIND_MAKE_MEM_UNDEFINED(ptr, arena->slab_size);
+		if (!slab_arena_release(arena, ptr)) {
+			slab_arena_cache_push(arena, ptr);
+			VALGRIND_MAKE_MEM_NOACCESS(ptr, arena->slab_size);
+			VALGRIND_MAKE_MEM_DEFINED(lf_lifo(ptr),
+						  sizeof(struct lf_lifo));
+			break;
+		}
+		if (slab_arena_is_numa(arena))
+			pm_atomic_fetch_sub(&from->used, arena->slab_size);
+		lf_lifo_push(&arena->trimmed, ptr);
+		VALGRIND_MAKE_MEM_NOACCESS(ptr, arena->slab_size);
+		VALGRIND_MAKE_MEM_DEFINED(lf_lifo(ptr), sizeof(struct lf_lifo));
+		quota_release(arena->quota, arena->slab_size);
+		released += arena->slab_size;
+	}
+	return released;
+}
+
+size_t
+slab_arena_trim(struct slab_arena *arena, size_t keep)
+{
+	return slab_arena_trim_step(arena, keep, SIZE_MAX);
+}
+
+void
+slab_arena_stats(struct slab_arena *arena, struct slab_arena_stats *stats)
+{
+	struct slab_arena_counters *counters = &arena->counters;
+	stats->counters.cache_hits = pm_atomic_load(&counters->cache_hits);
+	stats->counters.fresh_maps = pm_atomic_load(&counters->fresh_maps);
+	stats->counters.quota_refusals =
+		pm_atomic_load(&counters->quota_refusals);
+	stats->counters.prefault_hits =
+		pm_atomic_load(&counters->prefault_hits);
+	stats->counters.prefault_misses =
+		pm_atomic_load(&counters->prefault_misses);
+	stats->counters.mmaps = pm_atomic_load(&counters->mmaps);
+	stats->counters.munmaps = pm_atomic_load(&counters->munmaps);
+	stats->counters.madvises = pm_atomic_load(&counters->madvises);
+	stats->counters.mprotects = pm_atomic_load(&counters->mprotects);
+	stats->counters.peak_used = pm_atomic_load(&counters->peak_used);
+	stats->used = pm_atomic_load(&arena->used);
+	stats->cached = pm_atomic_load(&arena->cached);
+	stats->committed = pm_atomic_load(&arena->committed);
+	stats->prealloc = arena->prealloc;
+}
+
 void
 slab_arena_mprotect(struct slab_arena *arena)
 {
-	if (arena->arena)
-		mprotect(arena->arena, arena->prealloc, PROT_READ);
+	if (arena->arena) {
+		pm_atomic_fetch_add(&arena->counters.mprotects, 1);
+		mprotect(arena->arena, pm_atomic_load(&arena->committed),
+			 PROT_READ);
+	}
 }
@@ -59,6 +59,58 @@ const uint32_t slab_magic = 0xeec0ffee;
 #define SLAB_MIN_ORDER0_SIZE small_getpagesize()
 #endif /* !defined(SLAB_MIN_ORDER0_SIZE) */
 
+#if defined(TARANTOOL_SMALL_HAVE_MREMAP)
+enum {
+	/**
+	 * Large slabs of this size and bigger get a mapping of
+	 * their own, so that slab_grow_large() can remap them
+	 * instead of copying the data.
+	 */
+	SLAB_LARGE_MAP_MIN = 1024 * 1024,
+};
+#endif
+
+/** True if a large slab of @a size bytes is mmap()ed. */
+static inline bool
+slab_large_is_mapped(size_t size)
+{
+#if defined(TARANTOOL_SMALL_HAVE_MREMAP)
+	return size >= SLAB_LARGE_MAP_MIN;
+#else
+	(void) size;
+	return false;
+#endif
+}
+
+/** Length of the mapping of a large slab of @a size bytes. */
+static inline size_t
+slab_large_map_size(size_t size)
+{
+	return small_align(size, small_getpagesize());
+}
+
+/** Allocate memory for a large slab of @a size bytes. */
+static struct slab *
+slab_large_alloc(size_t size)
+{
+	if (!slab_large_is_mapped(size))
+		return (struct slab *) malloc(size);
+	void *ptr = mmap(NULL, slab_large_map_size(size),
+			 PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+			 -1, 0);
+	return ptr == MAP_FAILED ? NULL : (struct slab *) ptr;
+}
+
+/** Free memory of a large slab. */
+static void
+slab_large_free(struct slab *slab)
+{
+	if (slab_large_is_mapped(slab->size))
+		munmap(slab, slab_large_map_size(slab->size));
+	else
+		free(slab);
+}
+
 static inline void
 slab_assert(struct slab_cache *cache, struct slab *slab)
 {
@@ -97,6 +149,15 @@ slab_set_used(struct slab_cache *cache, struct slab *slab)
 	VALGRIND_MEMPOOL_ALLOC(cache, slab_data(slab), slab_capacity(slab));
 }
 
+/** The number of free slabs of order_max. */
+static inline size_t
+slab_cache_free_max(struct slab_cache *cache)
+{
+	struct slab_list *list = &cache->orders[cache->order_max];
+	return (list->stats.total - list->stats.used) /
+	       cache->arena->slab_size;
+}
+
 static inline bool
 slab_is_free(struct slab *slab)
 {
@@ -165,10 +226,144 @@ slab_merge(struct slab_cache *cache, struct slab *slab, struct slab *buddy)
 	return merged;
 }
 
+/** Free the least recently released cached large slab. */
+static void
+slab_large_evict(struct slab_cache *cache)
+{
+	struct slab *slab = rlist_last_entry(&cache->large_lru,
+					     struct slab, next_in_cache);
+	rlist_del_entry(slab, next_in_list);
+	rlist_del_entry(slab, next_in_cache);
+	cache->large_cached -= slab->size;
+	quota_release(cache->arena->quota, slab->size);
+	slab_large_free(slab);
+}
+
+/**
+ * Free all cached large slabs to release their quota when it
+ * is needed for an allocation.
+ * @return true if there was anything to free.
+ */
+static bool
+slab_large_flush(struct slab_cache *cache)
+{
+	if (rlist_empty(&cache->large_lru))
+		return false;
+	while (!rlist_empty(&cache->large_lru))
+		slab_large_evict(cache);
+	cache->large_idle = 0;
+	return true;
+}
+
+/** Get an arena slab, through the magazine if there is one. */
+static inline void *
+slab_cache_arena_map(struct slab_cache *cache)
+{
+	if (cache->magazine != NULL)
+		return slab_magazine_map(cache->magazine);
+	return slab_map(cache->arena);
+}
+
+/**
+ * Get an arena slab. Cached large slabs hold quota, so they
+ * are flushed and the slab is retried once before failing.
+ */
+static inline void *
+slab_cache_map(struct slab_cache *cache)
+{
+	void *ptr = slab_cache_arena_map(cache);
+	if (ptr == NULL && slab_large_flush(cache))
+		ptr = slab_cache_arena_map(cache);
+	return ptr;
+}
+
+/** Return an arena slab, through the magazine if there is one. */
+static inline void
+slab_cache_unmap(struct slab_cache *cache, struct slab *slab)
+{
+	if (cache->magazine != NULL)
+		slab_magazine_unmap(cache->magazine, slab);
+	else
+		slab_unmap(cache->arena, slab);
+}
+
+void
+slab_put_remote(struct slab_cache *cache, struct slab *slab)
+{
+	assert(slab->magic == slab_magic);
+	struct slab *head = pm_atomic_load(&cache->remote);
+	do {
+		slab->next_in_list.next = head != NULL ?
+					  &head->next_in_list : NULL;
+	} while (!pm_atomic_compare_exchange_weak(&cache->remote,
+						  &head, slab));
+}
+
+/** Free slabs put by other threads, see slab_put_remote(). */
+static inline void
+slab_cache_drain_remote(struct slab_cache *cache)
+{
+	if (pm_atomic_load(&cache->remote) == NULL)
+		return;
+	struct slab *slab = pm_atomic_exchange(&cache->remote, NULL);
+	while (slab != NULL) {
+		struct rlist *next = slab->next_in_list.next;
+		if (slab->order <= cache->order_max)
+			slab_put_with_order(cache, slab);
+		else
+			slab_put_large(cache, slab);
+		slab = next != NULL ?
+		       rlist_entry(next, struct slab, next_in_list) : NULL;
+	}
+}
+
+/** Take a large slab of at least @a size bytes from the cache. */
+static struct slab *
+slab_large_find(struct slab_cache *cache, size_t size)
+{
+	if (rlist_empty(&cache->large_lru))
+		return NULL;
+	/*
+	 * A slab from the size's own bin may be smaller than
+	 * the size. A slab from the next bin may be up to four
+	 * times bigger, do not waste more than a half of it.
+	 */
+	size_t bin = small_lb(size);
+	struct slab *slab;
+	rlist_foreach_entry(slab, &cache->large_bins[bin], next_in_list) {
+		if (slab->size >= size)
+			goto found;
+	}
+	if (bin + 1 == SLAB_LARGE_BIN_COUNT)
+		return NULL;
+	rlist_foreach_entry(slab, &cache->large_bins[bin + 1],
+			    next_in_list) {
+		if (slab->size <= 2 * size)
+			goto found;
+	}
+	return NULL;
+found:
+	rlist_del_entry(slab, next_in_list);
+	rlist_del_entry(slab, next_in_cache);
+	cache->large_cached -= slab->size;
+	if (cache->large_idle > cache->large_cached)
+		cache->large_idle = cache->large_cached;
+	return slab;
+}
+
 void
 slab_cache_create(struct slab_cache *cache, struct slab_arena *arena)
 {
 	cache->arena = arena;
+	cache->magazine = NULL;
+	cache->gc_idle = 0;
+	cache->remote = NULL;
+	for (size_t i = 0; i < SLAB_LARGE_BIN_COUNT; i++)
+		rlist_create(&cache->large_bins[i]);
+	rlist_create(&cache->large_lru);
+	cache->large_cached = 0;
+	cache->large_cached_max = 0;
+	cache->large_idle = 0;
 	/*
 	 * We have a fixed number of orders (ORDER_MAX); calculate
 	 * the size of buddies in the smallest order, given the size
@@ -196,6 +391,7 @@ slab_cache_create(struct slab_cache *cache, struct slab_arena *arena)
 void
 slab_cache_destroy(struct slab_cache *cache)
 {
+	slab_cache_drain_remote(cache);
 	struct rlist *slabs = &cache->allocated.slabs;
 	/*
 	 * cache->allocated contains huge allocations and
@@ -208,12 +404,13 @@ slab_cache_destroy(struct slab_cache *cache)
 			size_t slab_size = slab->size;
 			quota_release(cache->arena->quota, slab_size);
 			VALGRIND_MEMPOOL_FREE(cache, slab_data(slab));
-			free(slab);
+			slab_large_free(slab);
 		} else {
-			slab_unmap(cache->arena, slab);
+			slab_cache_unmap(cache, slab);
 		}
 	}
-
+	while (!rlist_empty(&cache->large_lru))
+		slab_large_evict(cache);
 
 	VALGRIND_DESTROY_MEMPOOL(cache);
 }
@@ -222,6 +419,7 @@ struct slab *
 slab_get_with_order(struct slab_cache *cache, uint8_t order)
 {
 	assert(order <= cache->order_max);
+	slab_cache_drain_remote(cache);
 	struct slab *slab;
 	/* Search for the first available slab. If a slab
 	 * of a bigger size is found, it can be split.
@@ -232,7 +430,7 @@ slab_get_with_order(struct slab_cache *cache, uint8_t order)
 
 	for ( ; rlist_empty(&list->slabs); list++) {
 		if (list == cache->orders + cache->order_max) {
-			slab = slab_map(cache->arena);
+			slab = slab_cache_map(cache);
 			if (slab == NULL)
 				return NULL;
 			slab_create(slab, cache->order_max,
@@ -264,22 +462,208 @@ slab_get_with_order(struct slab_cache *cache, uint8_t order)
 	}
 	slab_set_used(cache, slab);
 	slab_assert(cache, slab);
+	if (list == cache->orders + cache->order_max &&
+	    cache->gc_idle > slab_cache_free_max(cache))
+		cache->gc_idle = slab_cache_free_max(cache);
 	return slab;
 }
 
+void
+slab_cache_set_large_cache_size(struct slab_cache *cache, size_t max)
+{
+	cache->large_cached_max = max;
+	while (cache->large_cached > max)
+		slab_large_evict(cache);
+	if (cache->large_idle > cache->large_cached)
+		cache->large_idle = cache->large_cached;
+}
+
+/**
+ * Cut a free slab of a higher order into slabs of @a order,
+ * store up to @a count of them in @a slabs and return the rest
+ * to the free lists as the biggest possible buddies.
+ *
+ * @return the number of slabs stored
+ */
+static size_t
+slab_cut(struct slab_cache *cache, struct slab *slab, uint8_t order,
+	 size_t count, struct slab **slabs)
+{
+	assert(slab->order > order);
+	size_t size = slab_order_size(cache, order);
+	size_t total = slab->size / size;
+	size_t taken = total < count ? total : count;
+	char *base = (char *) slab;
+	for (size_t i = 0; i < taken; i++) {
+		slab = (struct slab *) (base + i * size);
+		VALGRIND_MAKE_MEM_UNDEFINED(slab, sizeof(*slab));
+		slab_create(slab, order, size);
+		slabs[i] = slab;
+	}
+	/*
+	 * The rest of the slab is aligned by the lowest set bit
+	 * of its index, so the buddies are formed greedily.
+	 */
+	for (size_t i = taken; i < total; ) {
+		uint8_t shift = __builtin_ctzl(i);
+		while (i + ((size_t) 1 << shift) > total)
+			shift--;
+		slab = (struct slab *) (base + i * size);
+		VALGRIND_MAKE_MEM_UNDEFINED(slab, sizeof(*slab));
+		slab_create(slab, order + shift, size << shift);
+		slab_list_add(&cache->orders[slab->order], slab, next_in_list);
+		i += (size_t) 1 << shift;
+	}
+	return taken;
+}
+
+size_t
+slab_get_batch(struct slab_cache *cache, uint8_t order, size_t count,
+	       struct slab **slabs)
+{
+	assert(order <= cache->order_max);
+	slab_cache_drain_remote(cache);
+	struct slab_list *list = &cache->orders[order];
+	size_t size = slab_order_size(cache, order);
+	size_t done = 0;
+	/* The number of slabs not yet billed to the order. */
+	size_t cut = 0;
+	while (done < count && !rlist_empty(&list->slabs)) {
+		slabs[done++] = rlist_shift_entry(&list->slabs, struct slab,
+						  next_in_list);
+	}
+	struct slab_list *last = &cache->orders[cache->order_max];
+	while (done < count) {
+		struct slab *slab;
+		struct slab_list *from = list;
+		while (from <= last && rlist_empty(&from->slabs))
+			from++;
+		if (from <= last) {
+			slab = rlist_shift_entry(&from->slabs, struct slab,
+						 next_in_list);
+			from->stats.total -= slab->size;
+		} else {
+			slab = slab_cache_map(cache);
+			if (slab == NULL)
+				break;
+			slab_create(slab, cache->order_max,
+				    cache->arena->slab_size);
+			slab_poison(slab);
+			slab_list_add(&cache->allocated, slab, next_in_cache);
+		}
+		if (slab->order == order) {
+			/* Left by a previous cut. */
+			slabs[done++] = slab;
+			cut++;
+			continue;
+		}
+		size_t taken = slab_cut(cache, slab, order, count - done,
+					slabs + done);
+		done += taken;
+		cut += taken;
+	}
+	for (size_t i = 0; i < done; i++) {
+		slabs[i]->in_use = 1 + order;
+		VALGRIND_MEMPOOL_ALLOC(cache, slab_data(slabs[i]),
+				       slab_capacity(slabs[i]));
+	}
+	cache->orders[order].stats.total += cut * size;
+	cache->orders[order].stats.used += done * size;
+	cache->allocated.stats.used += done * size;
+	if (cache->gc_idle > slab_cache_free_max(cache))
+		cache->gc_idle = slab_cache_free_max(cache);
+	return done;
+}
+
+void
+slab_put_batch(struct slab_cache *cache, struct slab **slabs, size_t count)
+{
+	slab_cache_drain_remote(cache);
+	/*
+	 * Bytes leaving the used and total counters of each order,
+	 * applied once for the whole batch. Merges move bytes up
+	 * the orders, so a total may go "negative" in between.
+	 */
+	struct small_stats freed[ORDER_MAX + 1];
+	memset(freed, 0, sizeof(freed));
+	size_t used = 0;
+	size_t unmapped = 0;
+	struct slab_list *max = &cache->orders[cache->order_max];
+	for (size_t i = 0; i < count; i++) {
+		struct slab *slab = slabs[i];
+		if (slab->order > cache->order_max) {
+			slab_put_large(cache, slab);
+			continue;
+		}
+		slab_assert(cache, slab);
+		assert(slab->in_use == slab->order + 1);
+		freed[slab->order].used += slab->size;
+		used += slab->size;
+		slab->in_use = 0;
+		VALGRIND_MEMPOOL_FREE(cache, slab_data(slab));
+		/* See slab_put_with_order() on the accounting. */
+		struct slab *buddy = slab_buddy(cache, slab);
+		if (buddy && buddy->order == slab->order &&
+		    slab_is_free(buddy)) {
+			freed[slab->order].total += slab->size;
+			do {
+				rlist_del_entry(buddy, next_in_list);
+				freed[buddy->order].total += buddy->size;
+				if (buddy < slab)
+					slab = buddy;
+				slab->order++;
+				slab->size = slab_order_size(cache,
+							     slab->order);
+				buddy = slab_buddy(cache, slab);
+			} while (buddy && buddy->order == slab->order &&
+				 slab_is_free(buddy));
+			freed[slab->order].total -= slab->size;
+		}
+		slab_poison(slab);
+		if (slab->order == cache->order_max &&
+		    !rlist_empty(&max->slabs)) {
+			assert(slab->size == cache->arena->slab_size);
+			rlist_del_entry(slab, next_in_cache);
+			freed[slab->order].total += slab->size;
+			unmapped += slab->size;
+			slab_cache_unmap(cache, slab);
+		} else {
+			rlist_add_entry(&cache->orders[slab->order].slabs,
+					slab, next_in_list);
+		}
+	}
+	for (uint8_t i = 0; i <= cache->order_max; i++) {
+		cache->orders[i].stats.used -= freed[i].used;
+		cache->orders[i].stats.total -= freed[i].total;
+	}
+	cache->allocated.stats.used -= used;
+	cache->allocated.stats.total -= unmapped;
+}
+
 struct slab *
 slab_get_large(struct slab_cache *cache, size_t size)
 {
+	slab_cache_drain_remote(cache);
 	size += slab_sizeof();
-	if (quota_use(cache->arena->quota, size) < 0)
+	/* A cached slab is still charged to the quota. */
+	struct slab *slab = slab_large_find(cache, size);
+	if (slab != NULL) {
+		size = slab->size;
+		goto done;
+	}
+	/* The quota may be held by cached slabs not fitting the size. */
+	if (quota_use(cache->arena->quota, size) < 0 &&
+	    (!slab_large_flush(cache) ||
+	     quota_use(cache->arena->quota, size) < 0))
 		return NULL;
-	struct slab *slab = (struct slab *) malloc(size);
+	slab = slab_large_alloc(size);
 	if (slab == NULL) {
 		quota_release(cache->arena->quota, size);
 		return NULL;
 	}
 
 	slab_create(slab, cache->order_max + 1, size);
+done:
 	slab_list_add(&cache->allocated, slab, next_in_cache);
 	cache->allocated.stats.used += size;
 	VALGRIND_MEMPOOL_ALLOC(cache, slab_data(slab),
@@ -292,18 +676,82 @@ slab_put_large(struct slab_cache *cache, struct slab *slab)
 {
 	slab_assert(cache, slab);
 	assert(slab->order == cache->order_max + 1);
-	/*
-	 * Free a huge slab right away, we have no
-	 * further business to do with it.
-	 */
 	size_t slab_size = slab->size;
 	slab_list_del(&cache->allocated, slab, next_in_cache);
 	cache->allocated.stats.used -= slab_size;
-	quota_release(cache->arena->quota, slab_size);
 	slab_poison(slab);
 	VALGRIND_MEMPOOL_FREE(cache, slab_data(slab));
-	free(slab);
-	return;
+	if (slab_size <= cache->large_cached_max) {
+		/* Keep the slab and its quota for reuse. */
+		rlist_add_entry(&cache->large_bins[small_lb(slab_size)],
+				slab, next_in_list);
+		rlist_add_entry(&cache->large_lru, slab, next_in_cache);
+		cache->large_cached += slab_size;
+		while (cache->large_cached > cache->large_cached_max)
+			slab_large_evict(cache);
+		return;
+	}
+	/*
+	 * Free a huge slab right away, we have no
+	 * further business to do with it.
+	 */
+	quota_release(cache->arena->quota, slab_size);
+	slab_large_free(slab);
+}
+
+struct slab *
+slab_grow_large(struct slab_cache *cache, struct slab *slab, size_t size,
+		size_t offset, size_t len)
+{
+	slab_assert(cache, slab);
+	assert(slab->order == cache->order_max + 1);
+	assert(offset + len <= slab_capacity(slab));
+	char *data = (char *) slab_data(slab);
+	if (size + slab_sizeof() <= slab->size) {
+		memmove(data, data + offset, len);
+		return slab;
+	}
+	struct slab *new_slab;
+#if defined(TARANTOOL_SMALL_HAVE_MREMAP)
+	if (slab_large_is_mapped(slab->size)) {
+		/* Let the kernel move the pages instead of copying. */
+		struct quota *quota = cache->arena->quota;
+		size_t new_size = size + slab_sizeof();
+		size_t delta = new_size - slab->size;
+		/* The quota is charged in units, so is the growth. */
+		size_t charge = small_align(new_size, QUOTA_UNIT_SIZE) -
+				small_align(slab->size, QUOTA_UNIT_SIZE);
+		if (charge > 0 && quota_use(quota, charge) < 0 &&
+		    (!slab_large_flush(cache) || quota_use(quota, charge) < 0))
+			return NULL;
+		slab_list_del(&cache->allocated, slab, next_in_cache);
+		new_slab = (struct slab *) mremap(
+			slab, slab_large_map_size(slab->size),
+			slab_large_map_size(new_size), MREMAP_MAYMOVE);
+		if (new_slab == MAP_FAILED) {
+			if (charge > 0)
+				quota_release(quota, charge);
+			slab_list_add(&cache->allocated, slab, next_in_cache);
+			return NULL;
+		}
+		new_slab->size = new_size;
+		VALGRIND_MEMPOOL_CHANGE(cache, slab_data(slab),
+					slab_data(new_slab),
+					slab_capacity(new_slab));
+		slab_list_add(&cache->allocated, new_slab, next_in_cache);
+		cache->allocated.stats.used += delta;
+		data = (char *) slab_data(new_slab);
+		memmove(data, data + offset, len);
+		return new_slab;
+	}
+#endif
+	/* A malloc()ed slab is small enough to be copied. */
+	new_slab = slab_get_large(cache, size);
+	if (new_slab == NULL)
+		return NULL;
+	memcpy(slab_data(new_slab), data + offset, len);
+	slab_put_large(cache, slab);
+	return new_slab;
 }
 
 /**
@@ -322,7 +770,10 @@ slab_get(struct slab_cache *cache, size_t size)
 		slab = slab_get_large(cache, size);
 	else
 		slab = slab_get_with_order(cache, order);
-	assert(slab == NULL || slab->size == slab_real_size(cache, size));
+	/* A large slab may be reused from the cache, bigger. */
+	assert(slab == NULL || slab->size == slab_real_size(cache, size) ||
+	       (order == cache->order_max + 1 &&
+		slab->size > slab_real_size(cache, size)));
 	return slab;
 }
 
@@ -368,7 +819,7 @@ slab_put_with_order(struct slab_cache *cache, struct slab *slab)
 		assert(slab->size == cache->arena->slab_size);
 		slab_list_del(&cache->allocated, slab, next_in_cache);
 		cache->orders[slab->order].stats.total -= slab->size;
-		slab_unmap(cache->arena, slab);
+		slab_cache_unmap(cache, slab);
 	} else {
 		/* Put the slab to the cache */
 		rlist_add_entry(&cache->orders[slab->order].slabs, slab,
@@ -376,9 +827,47 @@ slab_put_with_order(struct slab_cache *cache, struct slab *slab)
 	}
 }
 
+size_t
+slab_cache_gc(struct slab_cache *cache, size_t budget)
+{
+	struct slab_list *list = &cache->orders[cache->order_max];
+	size_t released = 0;
+	while (cache->gc_idle > 0 && !rlist_empty(&list->slabs) &&
+	       released + cache->arena->slab_size <= budget) {
+		/* The least recently used slab is at the tail. */
+		struct slab *slab = rlist_last_entry(&list->slabs,
+						     struct slab, next_in_list);
+		rlist_del_entry(slab, next_in_list);
+		slab_list_del(&cache->allocated, slab, next_in_cache);
+		list->stats.total -= slab->size;
+		released += slab->size;
+		slab_cache_unmap(cache, slab);
+		cache->gc_idle--;
+	}
+	cache->gc_idle = slab_cache_free_max(cache);
+	/*
+	 * Large slabs are freed in the LRU order, as long as
+	 * the bytes evicted do not exceed the idle bytes.
+	 */
+	while (cache->large_idle > 0 && !rlist_empty(&cache->large_lru)) {
+		struct slab *slab = rlist_last_entry(&cache->large_lru,
+						     struct slab,
+						     next_in_cache);
+		if (slab->size > cache->large_idle ||
+		    released + slab->size > budget)
+			break;
+		cache->large_idle -= slab->size;
+		released += slab->size;
+		slab_large_evict(cache);
+	}
+	cache->large_idle = cache->large_cached;
+	return released;
+}
+
 void
 slab_put(struct slab_cache *cache, struct slab *slab)
 {
+	slab_cache_drain_remote(cache);
 	if (slab->order <= cache->order_max)
 		return slab_put_with_order(cache, slab);
 	return slab_put_large(cache, slab);
@@ -475,6 +964,51 @@ slab_cache_check(struct slab_cache *cache)
 	abort();
 }
 
+void
+slab_cache_fragmentation(struct slab_cache *cache,
+			 struct slab_cache_fragmentation *frag,
+			 slab_pin_cb cb, void *arg)
+{
+	memset(frag, 0, sizeof(*frag));
+	size_t slab_size = cache->arena->slab_size;
+	struct slab *base;
+	rlist_foreach_entry(base, &cache->allocated.slabs, next_in_cache) {
+		/* Large and whole arena slabs. */
+		if (base->order >= cache->order_max)
+			continue;
+		/*
+		 * A split arena slab is a sequence of slabs of
+		 * lower orders, each starting with its header.
+		 */
+		char *end = (char *) base + slab_size;
+		struct slab *slab;
+		size_t stranded = 0;
+		uint32_t orders = 0;
+		for (char *p = (char *) base; p < end; p += slab->size) {
+			slab = (struct slab *) p;
+			assert(slab->magic == slab_magic);
+			if (!slab_is_free(slab))
+				continue;
+			stranded += slab->size;
+			frag->orders[slab->order].stranded += slab->size;
+			orders |= 1u << slab->order;
+		}
+		frag->split++;
+		frag->stranded += stranded;
+		for (uint8_t i = 0; i < cache->order_max; i++) {
+			if (orders & (1u << i))
+				frag->orders[i].split++;
+		}
+		if (cb == NULL)
+			continue;
+		for (char *p = (char *) base; p < end; p += slab->size) {
+			slab = (struct slab *) p;
+			if (!slab_is_free(slab))
+				cb(slab, stranded, arg);
+		}
+	}
+}
+
 size_t
 slab_real_size(struct slab_cache *cache, size_t size)
 {
@@ -38,8 +38,42 @@ enum {
 	 * Pools are arranged into groups with the same slab order.
 	 */
 	POOL_PER_GROUP_MAX = 32,
+	/** How many objects move between a tcache and mempools at once. */
+	TCACHE_BATCH = 32,
 };
 
+static inline int
+small_large_cmp(const struct small_large *lhs, const struct small_large *rhs)
+{
+	return lhs->slab > rhs->slab ? 1 : (lhs->slab < rhs->slab ? -1 : 0);
+}
+
+static inline int
+small_large_key_cmp(const struct slab *key, const struct small_large *node)
+{
+	return key > node->slab ? 1 : (key < node->slab ? -1 : 0);
+}
+
+rb_proto_ext_key(, small_large_tree_, small_large_tree_t, struct small_large,
+		 const struct slab *)
+
+rb_gen_ext_key(, small_large_tree_, small_large_tree_t, struct small_large,
+	       node, small_large_cmp, const struct slab *, small_large_key_cmp)
+
+/**
+ * The tree node of a large object, kept at the end of its slab,
+ * so that it is found without the object size. The slab may be
+ * bigger than requested if it is reused from the large slab cache.
+ */
+static inline struct small_large *
+small_large_node(struct slab *slab)
+{
+	uintptr_t node = (uintptr_t)slab + slab->size -
+			 sizeof(struct small_large);
+	return (struct small_large *)
+		(node & ~(uintptr_t)(sizeof(intptr_t) - 1));
+}
+
 static inline void
 small_mempool_update_group(struct small_mempool *small_mempool)
 {
@@ -127,6 +161,9 @@ small_mempool_can_be_deactivated(struct small_mempool *small_mempool)
 static inline void
 small_mempool_group_sweep_sparse(struct small_alloc *alloc)
 {
+	/* All pools stay active, see small_alloc_enable_nosize(). */
+	if (alloc->nosize)
+		return;
 	for (unsigned i = 0; i < alloc->small_mempool_cache_size; i++) {
 		struct small_mempool *pool = &alloc->small_mempool_cache[i];
 		if (small_mempool_can_be_deactivated(pool)) {
@@ -261,6 +298,8 @@ small_mempool_create(struct small_alloc *alloc)
 		pool->used_pool = NULL;
 		pool->appropriate_pool_mask = 0;
 		pool->waste = 0;
+		pool->tcache = NULL;
+		pool->tcache_count = 0;
 
 		if (first_iteration) {
 			slab_order_cur = pool->pool.slab_order;
@@ -315,6 +354,154 @@ small_alloc_create(struct small_alloc *alloc, struct slab_cache *cache,
 	small_class_create(&alloc->small_class, granularity,
 			   alloc->factor, objsize_min, actual_alloc_factor);
 	small_mempool_create(alloc);
+	alloc->tcache_size = 0;
+	alloc->nosize = false;
+	small_large_tree_new(&alloc->large);
+}
+
+void
+small_alloc_enable_nosize(struct small_alloc *alloc)
+{
+#ifndef NDEBUG
+	for (uint32_t i = 0; i < alloc->small_mempool_cache_size; i++)
+		assert(mempool_count(&alloc->small_mempool_cache[i].pool) == 0);
+#endif
+	assert(small_large_tree_empty(&alloc->large));
+	alloc->nosize = true;
+	/*
+	 * smfree_nosize() can't tell the size class an object was
+	 * requested from, so it could not reduce the class waste.
+	 * Make every class allocate from its own pool instead, so
+	 * that there is no waste to account at all.
+	 */
+	for (uint32_t i = 0; i < alloc->small_mempool_groups_size; i++) {
+		struct small_mempool_group *group =
+			&alloc->small_mempool_groups[i];
+		uint32_t count = group->last - group->first + 1;
+		group->active_pool_mask = count == POOL_PER_GROUP_MAX ?
+					  UINT32_MAX :
+					  (UINT32_C(1) << count) - 1;
+		small_mempool_update_group(group->first);
+	}
+}
+
+/**
+ * Account the waste of @a count objects of @a small_mempool
+ * allocated from its used pool.
+ */
+static inline void
+small_mempool_add_waste(struct small_mempool *small_mempool, uint32_t count)
+{
+	if (small_mempool->used_pool == small_mempool)
+		return;
+	/*
+	 * Waste for this allocation is the difference between
+	 * the size of objects optimal (i.e. best-fit) mempool and
+	 * used mempool.
+	 */
+	small_mempool->waste += (size_t)count *
+		(small_mempool->used_pool->pool.objsize -
+		 small_mempool->pool.objsize);
+	/*
+	 * In case when waste for this mempool becomes greater than
+	 * or equal to waste_max, we are updating the information
+	 * for the mempool group that this mempool belongs to,
+	 * that it can now be used for memory allocation.
+	 */
+	if (small_mempool->waste >= small_mempool->group->waste_max)
+		small_mempool_activate(small_mempool);
+}
+
+/**
+ * Fill the empty tcache of @a small_mempool with a batch of
+ * objects and return one more.
+ */
+static void *
+small_tcache_refill(struct small_alloc *alloc,
+		    struct small_mempool *small_mempool)
+{
+	assert(small_mempool->tcache_count == 0);
+	void *objs[TCACHE_BATCH];
+	uint32_t count = (alloc->tcache_size + 1) / 2 + 1;
+	if (count > TCACHE_BATCH)
+		count = TCACHE_BATCH;
+	struct mempool *pool = &small_mempool->used_pool->pool;
+	count = mempool_alloc_batch(pool, objs, count);
+	if (count == 0)
+		return NULL;
+	small_mempool_add_waste(small_mempool, count);
+	for (uint32_t i = 1; i < count; i++) {
+		memcpy(objs[i], &small_mempool->tcache, sizeof(void *));
+		small_mempool->tcache = objs[i];
+	}
+	small_mempool->tcache_count = count - 1;
+	return objs[0];
+}
+
+/**
+ * Return @a count objects from the tcache of @a small_mempool to
+ * the mempools they were allocated from.
+ */
+static void
+small_tcache_flush(struct small_mempool *small_mempool, uint32_t count)
+{
+	assert(count <= small_mempool->tcache_count);
+	intptr_t slab_ptr_mask = small_mempool->pool.slab_ptr_mask;
+	void *objs[TCACHE_BATCH];
+	while (count > 0) {
+		uint32_t n = count < TCACHE_BATCH ? count : TCACHE_BATCH;
+		for (uint32_t i = 0; i < n; i++) {
+			objs[i] = small_mempool->tcache;
+			memcpy(&small_mempool->tcache, objs[i], sizeof(void *));
+		}
+		small_mempool->tcache_count -= n;
+		count -= n;
+		/* Free runs of objects from the same mempool together. */
+		for (uint32_t i = 0, j; i < n; i = j) {
+			struct mslab *slab = (struct mslab *)
+				slab_from_ptr(objs[i], slab_ptr_mask);
+			struct mempool *pool = slab->mempool;
+			for (j = i + 1; j < n; j++) {
+				slab = (struct mslab *)
+					slab_from_ptr(objs[j], slab_ptr_mask);
+				if (slab->mempool != pool)
+					break;
+			}
+			size_t waste = (size_t)(j - i) *
+				(pool->objsize - small_mempool->pool.objsize);
+			assert(small_mempool->waste >= waste);
+			small_mempool->waste -= waste;
+			mempool_free_batch(pool, &objs[i], j - i);
+		}
+	}
+}
+
+/** Put a freed object of @a size to the tcache of @a pool. */
+static inline void
+small_tcache_put(struct small_alloc *alloc, struct small_mempool *pool,
+		 void *ptr, size_t size)
+{
+	if (pool->tcache_count == alloc->tcache_size)
+		small_tcache_flush(pool, (alloc->tcache_size + 1) / 2);
+#ifndef NDEBUG
+	memset(ptr, '#', size);
+#else
+	(void)size;
+#endif
+	memcpy(ptr, &pool->tcache, sizeof(void *));
+	pool->tcache = ptr;
+	pool->tcache_count++;
+}
+
+void
+small_alloc_set_tcache_size(struct small_alloc *alloc, uint32_t size)
+{
+	alloc->tcache_size = size;
+	for (uint32_t i = 0; i < alloc->small_mempool_cache_size; i++) {
+		struct small_mempool *pool = &alloc->small_mempool_cache[i];
+		if (pool->tcache_count > size)
+			small_tcache_flush(pool, pool->tcache_count - size);
+	}
 }
 
 /**
@@ -332,41 +519,49 @@ smalloc(struct small_alloc *alloc, size_t size)
 	struct small_mempool *small_mempool = small_mempool_search(alloc, size);
 	if (small_mempool == NULL) {
 		/* Object is too large, fallback to slab_cache */
+		if (alloc->nosize)
+			size = small_align(size, sizeof(intptr_t)) +
+			       sizeof(struct small_large);
 		struct slab *slab = slab_get_large(alloc->cache, size);
 		if (slab == NULL)
 			return NULL;
+		if (alloc->nosize) {
+			struct small_large *large = small_large_node(slab);
+			large->slab = slab;
+			small_large_tree_insert(&alloc->large, large);
+		}
 		return slab_data(slab);
 	}
+	void *ptr = small_mempool->tcache;
+	if (ptr != NULL) {
+		memcpy(&small_mempool->tcache, ptr, sizeof(void *));
+		small_mempool->tcache_count--;
+		return ptr;
+	}
+	if (alloc->tcache_size > 0) {
+		ptr = small_tcache_refill(alloc, small_mempool);
+		if (ptr != NULL)
+			return ptr;
+	}
 	struct mempool *pool = &small_mempool->used_pool->pool;
 	assert(size <= pool->objsize);
-	void *ptr = mempool_alloc(pool);
+	ptr = mempool_alloc(pool);
 	if (ptr == NULL) {
 		/*
 		 * In case we run out of memory let's try to deactivate some
 		 * pools and release their sparse slabs. It might not help tho.
+		 * Objects kept in tcaches go back to their slabs first.
 		 */
+		for (uint32_t i = 0; i < alloc->small_mempool_cache_size; i++) {
+			struct small_mempool *p = &alloc->small_mempool_cache[i];
+			small_tcache_flush(p, p->tcache_count);
+		}
 		small_mempool_group_sweep_sparse(alloc);
 		ptr = mempool_alloc(pool);
 	}
 
-	if (ptr != NULL && small_mempool->used_pool != small_mempool) {
-		/*
-		 * Waste for this allocation is the difference between
-		 * the size of objects optimal (i.e. best-fit) mempool and
-		 * used mempool.
-		 */
-		small_mempool->waste +=
-			(small_mempool->used_pool->pool.objsize -
-			 small_mempool->pool.objsize);
-		/*
-		 * In case when waste for this mempool becomes greater than
-		 * or equal to waste_max, we are updating the information
-		 * for the mempool group that this mempool belongs to,
-		 * that it can now be used for memory allocation.
-		 */
-		if (small_mempool->waste >= small_mempool->group->waste_max)
-			small_mempool_activate(small_mempool);
-	}
+	if (ptr != NULL)
+		small_mempool_add_waste(small_mempool, 1);
 
 	return ptr;
 }
@@ -385,9 +580,18 @@ smfree(struct small_alloc *alloc, void *ptr, size_t size)
 	if (pool == NULL) {
 		/* Large allocation by slab_cache */
 		struct slab *slab = slab_from_data(ptr);
+		if (alloc->nosize) {
+			struct small_large *large = small_large_node(slab);
+			assert(large->slab == slab);
+			small_large_tree_remove(&alloc->large, large);
+		}
 		slab_put_large(alloc->cache, slab);
 		return;
 	}
+	if (alloc->tcache_size > 0) {
+		small_tcache_put(alloc, pool, ptr, size);
+		return;
+	}
 
 	struct mslab *slab = (struct mslab *)
 		slab_from_ptr(ptr, pool->pool.slab_ptr_mask);
@@ -402,23 +606,75 @@ smfree(struct small_alloc *alloc, void *ptr, size_t size)
 	mempool_free_slab(slab->mempool, slab, ptr);
 }
 
+/**
+ * Find the slab of a small object by its address. Rounded down
+ * to the size of any slab order not less than the order of the
+ * object's slab, the address is the start of a slab: the slab
+ * containing it can't be larger without containing the object.
+ * So start from the largest order the pools use and, while the
+ * slab found does not contain the object, go to the largest
+ * order at which the address rounds down past that slab. The
+ * object's slab starts past it too, so that order is not less
+ * than the object's one.
+ */
+static inline struct mslab *
+small_mslab_from_ptr(struct small_alloc *alloc, void *ptr)
+{
+	struct slab_cache *cache = alloc->cache;
+	uint32_t last = alloc->small_mempool_cache_size - 1;
+	uint8_t order = alloc->small_mempool_cache[last].pool.slab_order;
+	size_t size = slab_order_size(cache, order);
+	struct slab *slab = slab_from_ptr(ptr, ~(intptr_t)(size - 1));
+	while (true) {
+		assert(slab->magic == slab_magic);
+		assert(slab->order <= order);
+		size_t offset = (char *)ptr - (char *)slab;
+		if (offset < (size_t)slab_order_size(cache, slab->order))
+			return (struct mslab *)slab;
+		order = small_lb(offset) - cache->order0_size_lb;
+		assert(order >= alloc->small_mempool_cache[0].pool.slab_order);
+		size = slab_order_size(cache, order);
+		slab = slab_from_ptr(ptr, ~(intptr_t)(size - 1));
+	}
+}
+
+void
+smfree_nosize(struct small_alloc *alloc, void *ptr)
+{
+	assert(alloc->nosize);
+	struct small_large *large =
+		small_large_tree_search(&alloc->large, slab_from_data(ptr));
+	if (large != NULL) {
+		small_large_tree_remove(&alloc->large, large);
+		slab_put_large(alloc->cache, large->slab);
+		return;
+	}
+	struct mslab *slab = small_mslab_from_ptr(alloc, ptr);
+	struct small_mempool *pool = slab->mempool->small_mempool;
+	if (alloc->tcache_size > 0) {
+		small_tcache_put(alloc, pool, ptr, pool->pool.objsize);
+		return;
+	}
+	mempool_free_slab(slab->mempool, slab, ptr);
+}
+
 /** Simplify iteration over small allocator mempools. */
-struct mempool_iterator
+struct small_mempool_iterator
 {
 	struct small_alloc *alloc;
 	uint32_t small_iterator;
 };
 
-void
-mempool_iterator_create(struct mempool_iterator *it,
-			struct small_alloc *alloc)
+static void
+small_mempool_iterator_create(struct small_mempool_iterator *it,
+			      struct small_alloc *alloc)
 {
 	it->alloc = alloc;
 	it->small_iterator = 0;
 }
 
-struct mempool *
-mempool_iterator_next(struct mempool_iterator *it)
+static struct mempool *
+small_mempool_iterator_next(struct small_mempool_iterator *it)
 {
 	struct small_mempool *small_mempool = NULL;
 	if (it->small_iterator < it->alloc->small_mempool_cache_size)
@@ -434,10 +690,10 @@ mempool_iterator_next(struct mempool_iterator *it)
 void
 small_alloc_destroy(struct small_alloc *alloc)
 {
-	struct mempool_iterator it;
-	mempool_iterator_create(&it, alloc);
+	struct small_mempool_iterator it;
+	small_mempool_iterator_create(&it, alloc);
 	struct mempool *pool;
-	while ((pool = mempool_iterator_next(&it))) {
+	while ((pool = small_mempool_iterator_next(&it))) {
 		mempool_destroy(pool);
 	}
 }
@@ -450,11 +706,11 @@ small_stats(struct small_alloc *alloc,
 {
 	memset(totals, 0, sizeof(*totals));
 
-	struct mempool_iterator it;
-	mempool_iterator_create(&it, alloc);
+	struct small_mempool_iterator it;
+	small_mempool_iterator_create(&it, alloc);
 	struct mempool *pool;
 
-	while ((pool = mempool_iterator_next(&it))) {
+	while ((pool = small_mempool_iterator_next(&it))) {
 		struct mempool_stats stats;
 		mempool_stats(pool, &stats);
 		totals->used += stats.totals.used;
@@ -78,6 +78,13 @@ smfree(struct small_alloc *alloc, void *ptr, size_t size)
 	small_asan_free(obj);
 }
 
+SMALL_NO_SANITIZE_ADDRESS void
+smfree_nosize(struct small_alloc *alloc, void *ptr)
+{
+	struct small_object *obj = small_asan_header_from_payload(ptr);
+	smfree(alloc, ptr, obj->size);
+}
+
 void
 small_stats(struct small_alloc *alloc,
 	    struct small_stats *totals,
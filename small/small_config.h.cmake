@@ -22,12 +22,47 @@
  */
 #cmakedefine TARANTOOL_SMALL_HAVE_MADVISE 1
 #cmakedefine TARANTOOL_SMALL_HAVE_MADV_DONTDUMP 1
+#cmakedefine TARANTOOL_SMALL_HAVE_MADV_REMOVE 1
+#cmakedefine TARANTOOL_SMALL_HAVE_MADV_POPULATE_WRITE 1
 
 #if defined(TARANTOOL_SMALL_HAVE_MADVISE)	&& \
     defined(TARANTOOL_SMALL_HAVE_MADV_DONTDUMP)
 # define TARANTOOL_SMALL_USE_MADVISE 1
 #endif
 
+/*
+ * Defined if this platform supports huge pages: either
+ * explicit hugetlbfs-backed mappings or transparent huge
+ * pages requested with madvise(..).
+ */
+#cmakedefine TARANTOOL_SMALL_HAVE_MAP_HUGETLB 1
+#cmakedefine TARANTOOL_SMALL_HAVE_MADV_HUGEPAGE 1
+
+#if defined(TARANTOOL_SMALL_HAVE_MADVISE)	&& \
+    defined(TARANTOOL_SMALL_HAVE_MADV_HUGEPAGE)
+# define TARANTOOL_SMALL_USE_MADV_HUGEPAGE 1
+#endif
+
+/*
+ * Defined if this platform can grow a mapping with mremap(..),
+ * moving it if needed.
+ */
+#cmakedefine TARANTOOL_SMALL_HAVE_MREMAP 1
+
+/*
+ * Defined if this platform has NUMA memory policy system
+ * calls (there is no need in libnuma, raw syscalls are used).
+ */
+#cmakedefine TARANTOOL_SMALL_HAVE_SYS_MBIND 1
+#cmakedefine TARANTOOL_SMALL_HAVE_SYS_GET_MEMPOLICY 1
+#cmakedefine TARANTOOL_SMALL_HAVE_SYS_GETCPU 1
+
+#if defined(TARANTOOL_SMALL_HAVE_SYS_MBIND)		&& \
+    defined(TARANTOOL_SMALL_HAVE_SYS_GET_MEMPOLICY)	&& \
+    defined(TARANTOOL_SMALL_HAVE_SYS_GETCPU)
+# define TARANTOOL_SMALL_USE_NUMA 1
+#endif
+
 /*
  * Defined if configured with ENABLE_ASAN.
  */
@@ -49,6 +49,12 @@ typedef bool (*rt_helper_t)(void);
 static uint64_t builtin_mask =
 #ifdef TARANTOOL_SMALL_USE_MADVISE
 	SMALL_FEATURE_MASK(SMALL_FEATURE_DONTDUMP)	|
+#endif
+#ifdef TARANTOOL_SMALL_HAVE_MAP_HUGETLB
+	SMALL_FEATURE_MASK(SMALL_FEATURE_HUGETLB)	|
+#endif
+#ifdef TARANTOOL_SMALL_USE_MADV_HUGEPAGE
+	SMALL_FEATURE_MASK(SMALL_FEATURE_THP)		|
 #endif
 	0;
 
@@ -97,11 +103,85 @@ out:
 static bool test_dontdump(void) { return false; }
 #endif
 
+#ifdef TARANTOOL_SMALL_HAVE_MAP_HUGETLB
+static bool
+test_hugetlb(void)
+{
+	size_t size = small_gethugepagesize();
+	intptr_t ignore_it;
+	char buf[64];
+	void *ptr;
+
+	(void)ignore_it;
+
+	if (size == 0)
+		return false;
+
+	/*
+	 * The hugetlb pool may be empty or exhausted, the only
+	 * reliable way to know is to try to map a huge page.
+	 */
+	ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		   MAP_ANONYMOUS | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
+	if (ptr == MAP_FAILED)
+		return false;
+
+	if (munmap(ptr, size)) {
+		ignore_it = (intptr_t)strerror_r(errno, buf, sizeof(buf));
+		fprintf(stderr, "Error in munmap(%p, %zu): %s\n",
+			ptr, size, buf);
+	}
+	return true;
+}
+#else
+static bool test_hugetlb(void) { return false; }
+#endif
+
+#ifdef TARANTOOL_SMALL_USE_MADV_HUGEPAGE
+static bool
+test_thp(void)
+{
+	size_t size = small_getpagesize();
+	intptr_t ignore_it;
+	bool ret = false;
+	char buf[64];
+	void *ptr;
+
+	(void)ignore_it;
+
+	/*
+	 * MADV_HUGEPAGE fails with EINVAL if the kernel is
+	 * built without transparent huge pages support.
+	 */
+	ptr = mmap(NULL, size, PROT_READ, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+	if (ptr == MAP_FAILED) {
+		ignore_it = (intptr_t)strerror_r(errno, buf, sizeof(buf));
+		fprintf(stderr, "Error in mmap(NULL, %zu, ...): %s\n", size, buf);
+		goto out;
+	}
+
+	if (madvise(ptr, size, MADV_HUGEPAGE) == 0)
+		ret = true;
+
+	if (munmap(ptr, size)) {
+		ignore_it = (intptr_t)strerror_r(errno, buf, sizeof(buf));
+		fprintf(stderr, "Error in munmap(%p, %zu): %s\n",
+			ptr, size, buf);
+	}
+out:
+	return ret;
+}
+#else
+static bool test_thp(void) { return false; }
+#endif
+
 /*
  * Runtime testers, put there features if they are dynamic.
  */
 static rt_helper_t rt_helpers[FEATURE_MAX] = {
 	[SMALL_FEATURE_DONTDUMP]	= test_dontdump,
+	[SMALL_FEATURE_HUGETLB]		= test_hugetlb,
+	[SMALL_FEATURE_THP]		= test_thp,
 };
 
 /**
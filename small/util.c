@@ -41,6 +41,34 @@ small_xmalloc_fail(size_t size, const char *filename, int line)
 	exit(EXIT_FAILURE);
 }
 
+size_t
+small_gethugepagesize(void)
+{
+	/*
+	 * The value can't change while the system is up,
+	 * so a benign race on the first call is fine.
+	 */
+	static size_t huge_page_size = SIZE_MAX;
+	if (huge_page_size != SIZE_MAX)
+		return huge_page_size;
+
+	size_t size = 0;
+	FILE *f = fopen("/proc/meminfo", "r");
+	if (f != NULL) {
+		char buf[128];
+		unsigned long kb;
+		while (fgets(buf, sizeof(buf), f)) {
+			if (sscanf(buf, "Hugepagesize: %lu kB", &kb) == 1) {
+				size = (size_t)kb * 1024;
+				break;
+			}
+		}
+		fclose(f);
+	}
+	huge_page_size = size;
+	return size;
+}
+
 #ifdef ENABLE_ASAN
 
 #include <pmatomic.h>
@@ -19,9 +19,45 @@ int ITERATIONS = 1009 /* 100003 */;
 int OSCILLATION = 137;
 int FILL = SLAB_MIN_SIZE/sizeof(pthread_t);
 
+static void *
+map(void *mag)
+{
+#ifndef ENABLE_ASAN
+	if (mag != NULL)
+		return slab_magazine_map(mag);
+#endif
+	(void)mag;
+	return slab_map(&arena);
+}
+
+static void
+unmap(void *mag, void *ptr)
+{
+#ifndef ENABLE_ASAN
+	if (mag != NULL) {
+		slab_magazine_unmap(mag, ptr);
+		return;
+	}
+#endif
+	(void)mag;
+	slab_unmap(&arena, ptr);
+}
+
+/** @a p points to a bool telling whether to use a magazine. */
 void *
-run(void *p __attribute__((unused)))
+run(void *p)
 {
+	bool use_magazine = *(bool *)p;
+	void *mag = NULL;
+#ifndef ENABLE_ASAN
+	struct slab_magazine magazine;
+	if (use_magazine) {
+		mag = &magazine;
+		slab_magazine_create(mag, &arena, SLAB_MAGAZINE_SIZE_MAX);
+	}
+#else
+	(void)use_magazine;
+#endif
 #ifdef __FreeBSD__
 	unsigned int seed = pthread_getthreadid_np();
 #else
@@ -29,11 +65,11 @@ run(void *p __attribute__((unused)))
 #endif
 	note("random seed is %u", seed);
 	int iterations = rand_r(&seed) % ITERATIONS;
-	pthread_t **slabs = slab_map(&arena);
+	pthread_t **slabs = map(mag);
 	for (int i = 0; i < iterations; i++) {
 		int oscillation = rand_r(&seed) % OSCILLATION;
 		for (int osc = 0; osc  < oscillation; osc++) {
-			slabs[osc] = (pthread_t *) slab_map(&arena);
+			slabs[osc] = (pthread_t *) map(mag);
 			for (int fill = 0; fill < FILL; fill += 100) {
 				slabs[osc][fill] = pthread_self();
 			}
@@ -44,15 +80,19 @@ run(void *p __attribute__((unused)))
 				fail_unless(slabs[osc][fill] ==
 					    pthread_self());
 			}
-			slab_unmap(&arena, slabs[osc]);
+			unmap(mag, slabs[osc]);
 		}
 	}
-	slab_unmap(&arena, slabs);
+	unmap(mag, slabs);
+#ifndef ENABLE_ASAN
+	if (mag != NULL)
+		slab_magazine_destroy(mag);
+#endif
 	return 0;
 }
 
 void
-bench(int count)
+bench(int count, bool use_magazine)
 {
 	pthread_attr_t attr;
 	pthread_attr_init(&attr);
@@ -61,7 +101,7 @@ bench(int count)
 
 	int i;
 	for (i = 0; i < count; i++) {
-		pthread_create(&threads[i], &attr, run, NULL);
+		pthread_create(&threads[i], &attr, run, &use_magazine);
 	}
 	for (i = 0; i < count; i++) {
 		pthread_t *thread = &threads[i];
@@ -73,17 +113,32 @@ bench(int count)
 int
 main()
 {
+#ifdef ENABLE_ASAN
 	plan(1);
+#else
+	plan(2);
+#endif
 	header();
 
 	size_t maxalloc = THREADS * (OSCILLATION + 1) * SLAB_MIN_SIZE;
 	quota_init(&quota, maxalloc);
 	slab_arena_create(&arena, &quota, maxalloc/8,
 			  SLAB_MIN_SIZE, MAP_PRIVATE);
-	bench(THREADS);
+	bench(THREADS, false);
 	ok(true);
 	slab_arena_destroy(&arena);
 
+#ifndef ENABLE_ASAN
+	/* Slabs kept in magazines are billed to the quota too. */
+	maxalloc += THREADS * SLAB_MAGAZINE_SIZE_MAX * SLAB_MIN_SIZE;
+	quota_init(&quota, maxalloc);
+	slab_arena_create(&arena, &quota, maxalloc/8,
+			  SLAB_MIN_SIZE, MAP_PRIVATE);
+	bench(THREADS, true);
+	ok(arena.cached == arena.used);
+	slab_arena_destroy(&arena);
+#endif
+
 	footer();
 	return check_plan();
 }
@@ -205,7 +205,43 @@ test_ibuf_consume_before(void)
 	check_plan();
 }
 
-#ifdef ENABLE_ASAN
+#ifndef ENABLE_ASAN
+
+static void
+test_ibuf_grow_large(void)
+{
+	plan(5);
+	header();
+
+	struct ibuf ibuf;
+	ibuf_create(&ibuf, &cache, 16 * 1024);
+	size_t size = 6 * 1024 * 1024;
+	char *ptr = ibuf_alloc(&ibuf, size);
+	fail_unless(ptr != NULL);
+	for (size_t i = 0; i < size; i++)
+		ptr[i] = i % 251;
+	ibuf_consume(&ibuf, 1000);
+	size_t used = slab_cache_used(&cache);
+	size_t capacity = ibuf_capacity(&ibuf);
+	/* A large buffer is grown copying the unconsumed data only. */
+	ptr = ibuf_alloc(&ibuf, 2 * size);
+	ok(ptr != NULL);
+	ok(ibuf_used(&ibuf) == 3 * size - 1000);
+	ok(ibuf_capacity(&ibuf) >= 3 * size);
+	ok(slab_cache_used(&cache) - used ==
+	   ibuf_capacity(&ibuf) - capacity);
+	bool intact = true;
+	for (size_t i = 1000; i < size; i++)
+		intact = intact && ibuf.rpos[i - 1000] == (char)(i % 251);
+	ok(intact);
+	slab_cache_check(&cache);
+	ibuf_destroy(&ibuf);
+
+	footer();
+	check_plan();
+}
+
+#else /* ifdef ENABLE_ASAN */
 
 static void
 test_ibuf_poison(void)
@@ -352,15 +388,11 @@ test_ibuf_poison(void)
 	check_plan();
 }
 
-#endif /* ifdef ENABLE_ASAN */
+#endif /* ifndef ENABLE_ASAN */
 
 int main()
 {
-#ifdef ENABLE_ASAN
 	plan(7);
-#else
-	plan(6);
-#endif
 	header();
 
 	quota_init(&quota, UINT_MAX);
@@ -376,6 +408,8 @@ int main()
 	test_ibuf_consume_before();
 #ifdef ENABLE_ASAN
 	test_ibuf_poison();
+#else
+	test_ibuf_grow_large();
 #endif
 
 	slab_cache_destroy(&cache);
@@ -3,8 +3,10 @@
 #include <stdalign.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
 #include <time.h>
+#include <pthread.h>
 #include "unit.h"
 
 enum {
@@ -121,7 +123,365 @@ mempool_align()
 	check_plan();
 }
 
-#ifdef ENABLE_ASAN
+#ifndef ENABLE_ASAN
+
+static void
+mempool_magazine(void)
+{
+	plan(6);
+	header();
+
+	mempool_create(&pool, &cache, objsize);
+	mempool_set_magazine_size(&pool, 8);
+	void *ptr[100];
+	for (int i = 0; i < (int)lengthof(ptr); i++)
+		ptr[i] = mempool_alloc(&pool);
+	for (int i = 0; i < (int)lengthof(ptr); i++)
+		mempool_free(&pool, ptr[i]);
+	ok(pool.magazine_count > 0 && pool.magazine_count <= 8);
+	ok(mempool_count(&pool) == 0);
+	/* The object freed last is reused first. */
+	ok(mempool_alloc(&pool) == ptr[lengthof(ptr) - 1]);
+	mempool_free(&pool, ptr[lengthof(ptr) - 1]);
+	mempool_set_magazine_size(&pool, 0);
+	ok(pool.magazine_count == 0 && pool.magazine == NULL);
+	/* All slabs but the spare one are released. */
+	ok(mempool_total(&pool) ==
+	   (size_t)slab_order_size(&cache, pool.slab_order));
+
+	/* The random workload with the magazine. */
+	mempool_set_magazine_size(&pool, 16);
+	memset(ptrs, 0, sizeof(ptrs));
+	used = 0;
+	allocating = true;
+	for (int i = 0; i < ITERATIONS_MAX; i++) {
+		basic_alloc_streak();
+		allocating = ! allocating;
+	}
+	ok(mempool_used(&pool) == used);
+	mempool_destroy(&pool);
+
+	footer();
+	check_plan();
+}
+
+static int
+ptr_cmp(const void *a, const void *b)
+{
+	uintptr_t lhs = (uintptr_t)*(void **)a;
+	uintptr_t rhs = (uintptr_t)*(void **)b;
+	return lhs < rhs ? -1 : lhs > rhs;
+}
+
+static void
+mempool_batch(void)
+{
+	plan(6);
+	header();
+
+	mempool_create(&pool, &cache, objsize);
+	mempool_set_magazine_size(&pool, 4);
+	uint32_t count = 3 * pool.objcount + 5;
+	void **objs = calloc(count, sizeof(*objs));
+	fail_unless(objs != NULL);
+	/* Leave something in the magazine. */
+	mempool_free(&pool, mempool_alloc(&pool));
+	ok(mempool_alloc_batch(&pool, objs, count) == count);
+	ok(mempool_count(&pool) == count);
+	for (uint32_t i = 0; i < count; i++)
+		memset(objs[i], 0, objsize);
+	qsort(objs, count, sizeof(*objs), ptr_cmp);
+	bool distinct = true;
+	for (uint32_t i = 1; i < count; i++)
+		distinct = distinct && objs[i - 1] != objs[i];
+	ok(distinct);
+	/* Free every other object and get them back. */
+	for (uint32_t i = 0; i < count; i += 2)
+		mempool_free(&pool, objs[i]);
+	mempool_set_magazine_size(&pool, 0);
+	uint32_t half = (count + 1) / 2;
+	void **more = calloc(half, sizeof(*more));
+	fail_unless(more != NULL);
+	ok(mempool_alloc_batch(&pool, more, half) == half);
+	ok(mempool_total(&pool) ==
+	   4 * (size_t)slab_order_size(&cache, pool.slab_order));
+	mempool_free_batch(&pool, more, half);
+	for (uint32_t i = 1; i < count; i += 2)
+		mempool_free_batch(&pool, &objs[i], 1);
+	/* All slabs but the spare one are released. */
+	ok(mempool_count(&pool) == 0 && mempool_total(&pool) ==
+	   (size_t)slab_order_size(&cache, pool.slab_order));
+	free(more);
+	free(objs);
+	mempool_destroy(&pool);
+
+	footer();
+	check_plan();
+}
+
+static void
+mempool_iterator_test(void)
+{
+	plan(3);
+	header();
+
+	mempool_create(&pool, &cache, objsize);
+	mempool_set_flags(&pool, MEMPOOL_COLORING | MEMPOOL_PREFETCH);
+	mempool_set_magazine_size(&pool, 8);
+	struct mempool_iterator it;
+	fail_unless(mempool_iterator_create(&it, &pool) == 0);
+	ok(mempool_iterator_next(&it) == NULL);
+	mempool_iterator_destroy(&it);
+
+	uint32_t count = 3 * pool.objcount + 5;
+	void **objs = calloc(count, sizeof(*objs));
+	void **found = calloc(count, sizeof(*found));
+	fail_unless(objs != NULL && found != NULL);
+	for (uint32_t i = 0; i < count; i++)
+		objs[i] = mempool_alloc(&pool);
+	/* Free objects at random, some stay in the magazine. */
+	uint32_t live = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		if (rand() % 2 == 0)
+			mempool_free(&pool, objs[i]);
+		else
+			objs[live++] = objs[i];
+	}
+	fail_unless(mempool_iterator_create(&it, &pool) == 0);
+	uint32_t nfound = 0;
+	void *obj;
+	while ((obj = mempool_iterator_next(&it)) != NULL &&
+	       nfound < count)
+		found[nfound++] = obj;
+	mempool_iterator_destroy(&it);
+	ok(nfound == live);
+	qsort(objs, live, sizeof(*objs), ptr_cmp);
+	qsort(found, nfound, sizeof(*found), ptr_cmp);
+	ok(memcmp(objs, found, live * sizeof(*objs)) == 0);
+	for (uint32_t i = 0; i < live; i++)
+		mempool_free(&pool, objs[i]);
+	free(found);
+	free(objs);
+	mempool_destroy(&pool);
+
+	footer();
+	check_plan();
+}
+
+enum { DEFRAG_SLABS = 8 };
+
+static void **defrag_objs;
+
+/** Move an object keeping its index in defrag_objs. */
+static bool
+defrag_move(void *old_obj, void *new_obj, void *arg)
+{
+	uint32_t idx;
+	memcpy(&idx, old_obj, sizeof(idx));
+	if (arg != NULL && *(uint32_t *)arg == idx)
+		return false;
+	memcpy(new_obj, old_obj, pool.objsize);
+	defrag_objs[idx] = new_obj;
+	return true;
+}
+
+static void
+mempool_defrag_test(void)
+{
+	plan(5);
+	header();
+
+	mempool_create(&pool, &cache, 64);
+	size_t slab_size = slab_order_size(&cache, pool.slab_order);
+	uint32_t count = DEFRAG_SLABS * pool.objcount;
+	defrag_objs = calloc(count, sizeof(*defrag_objs));
+	fail_unless(defrag_objs != NULL);
+	for (uint32_t i = 0; i < count; i++) {
+		defrag_objs[i] = mempool_alloc(&pool);
+		fail_unless(defrag_objs[i] != NULL);
+		memset(defrag_objs[i], 0, pool.objsize);
+		memcpy(defrag_objs[i], &i, sizeof(i));
+	}
+	/* Leave every slab used for 1/8. */
+	uint32_t live = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		if (i % DEFRAG_SLABS == 0) {
+			live++;
+			continue;
+		}
+		mempool_free(&pool, defrag_objs[i]);
+		defrag_objs[i] = NULL;
+	}
+	ok(mempool_defrag(&pool, 5, defrag_move, NULL) == 5);
+	/* Pin an object in the last slab. */
+	uint32_t pinned = count - DEFRAG_SLABS;
+	void *pinned_obj = defrag_objs[pinned];
+	mempool_defrag(&pool, SIZE_MAX, defrag_move, &pinned);
+	ok(mempool_count(&pool) == live);
+	bool intact = true;
+	for (uint32_t i = 0; i < count; i += DEFRAG_SLABS) {
+		uint32_t idx;
+		memcpy(&idx, defrag_objs[i], sizeof(idx));
+		intact = intact && idx == i;
+	}
+	ok(intact);
+	ok(defrag_objs[pinned] == pinned_obj);
+	/* The live objects fit in a slab, plus the pinned and the spare. */
+	ok(mempool_total(&pool) == 3 * slab_size);
+	for (uint32_t i = 0; i < count; i += DEFRAG_SLABS)
+		mempool_free(&pool, defrag_objs[i]);
+	free(defrag_objs);
+	mempool_destroy(&pool);
+
+	footer();
+	check_plan();
+}
+
+/** The leftmost hot slab must be the first one. */
+static bool
+mempool_check_first_hot(void)
+{
+	struct mslab *first = NULL;
+	struct slab *slab;
+	rlist_foreach_entry(slab, &pool.slabs.slabs, next_in_list) {
+		struct mslab *mslab = (struct mslab *)slab;
+		if (mslab->in_hot_slabs && (first == NULL || mslab < first))
+			first = mslab;
+	}
+	return first == pool.first_hot_slab;
+}
+
+static void
+mempool_pairing_heap(void)
+{
+	plan(2);
+	header();
+
+	mempool_create(&pool, &cache, objsize);
+	mempool_set_flags(&pool, MEMPOOL_PAIRING_HEAP);
+	memset(ptrs, 0, sizeof(ptrs));
+	used = 0;
+	allocating = true;
+	bool first_hot = true;
+	for (int i = 0; i < ITERATIONS_MAX; i++) {
+		int oscillation = rand() % OSCILLATION_MAX;
+		for (int j = 0; j < oscillation; j++) {
+			alloc_checked();
+			first_hot = first_hot && mempool_check_first_hot();
+		}
+		allocating = ! allocating;
+	}
+	ok(first_hot);
+	ok(mempool_used(&pool) == used);
+	mempool_destroy(&pool);
+
+	footer();
+	check_plan();
+}
+
+static void
+mempool_layout(void)
+{
+	plan(4);
+	header();
+
+	/* The first objects of new slabs are in different cache lines. */
+	mempool_create(&pool, &cache, 48);
+	mempool_set_flags(&pool, MEMPOOL_COLORING);
+	ok(pool.color_count > 1);
+	void **objs = calloc(pool.objcount * pool.color_count,
+			     sizeof(*objs));
+	fail_unless(objs != NULL);
+	uint32_t count = pool.objcount * pool.color_count;
+	for (uint32_t i = 0; i < count; i++)
+		objs[i] = mempool_alloc(&pool);
+	bool colored = true;
+	for (uint32_t i = 1; i < pool.color_count; i++) {
+		uintptr_t prev = (uintptr_t)objs[(i - 1) * pool.objcount];
+		uintptr_t cur = (uintptr_t)objs[i * pool.objcount];
+		colored = colored && (prev & ~pool.slab_ptr_mask) -
+			  (cur & ~pool.slab_ptr_mask) == pool.color_step;
+	}
+	ok(colored);
+	for (uint32_t i = 0; i < count; i++)
+		mempool_free(&pool, objs[i]);
+	free(objs);
+	mempool_destroy(&pool);
+
+	/* No object crosses more cache lines than necessary. */
+	uint32_t sizes[] = {24, 96};
+	for (int i = 0; i < (int)lengthof(sizes); i++) {
+		mempool_create(&pool, &cache, sizes[i]);
+		mempool_set_flags(&pool, MEMPOOL_NO_STRADDLE);
+		bool aligned = true;
+		uint32_t lines = (sizes[i] + 63) / 64;
+		for (uint32_t j = 0; j < pool.objcount; j++) {
+			uintptr_t addr = (uintptr_t)mempool_alloc(&pool);
+			aligned = aligned && (addr + sizes[i] - 1) / 64 -
+				  addr / 64 + 1 == lines;
+		}
+		ok(aligned);
+		mempool_destroy(&pool);
+	}
+
+	footer();
+	check_plan();
+}
+
+enum { REMOTE_OBJECTS = 20000 };
+
+static void *remote_objs[REMOTE_OBJECTS];
+
+static void *
+free_remote_f(void *arg)
+{
+	int start = (intptr_t)arg;
+	for (int i = start; i < REMOTE_OBJECTS; i += 2)
+		mempool_free_remote(&pool, remote_objs[i]);
+	return NULL;
+}
+
+static void
+mempool_remote(void)
+{
+	plan(4);
+	header();
+
+	mempool_create(&pool, &cache, objsize);
+	for (int i = 0; i < REMOTE_OBJECTS; i++) {
+		remote_objs[i] = mempool_alloc(&pool);
+		fail_unless(remote_objs[i] != NULL);
+	}
+	pthread_t threads[2];
+	for (intptr_t i = 0; i < 2; i++) {
+		fail_unless(pthread_create(&threads[i], NULL, free_remote_f,
+					   (void *)i) == 0);
+	}
+	/* The owner keeps allocating while objects are freed. */
+	void *local[64];
+	for (int i = 0; i < 1000; i++) {
+		for (int j = 0; j < (int)lengthof(local); j++)
+			local[j] = mempool_alloc(&pool);
+		for (int j = 0; j < (int)lengthof(local); j++)
+			mempool_free(&pool, local[j]);
+	}
+	for (int i = 0; i < 2; i++)
+		pthread_join(threads[i], NULL);
+	ok(pool.remote_slabs != NULL || mempool_count(&pool) == 0);
+	void *ptr = mempool_alloc(&pool);
+	ok(pool.remote_slabs == NULL);
+	ok(mempool_count(&pool) == 1);
+	mempool_free(&pool, ptr);
+	/* All slabs but the spare one are released. */
+	ok(mempool_total(&pool) ==
+	   (size_t)slab_order_size(&cache, pool.slab_order));
+	mempool_destroy(&pool);
+
+	footer();
+	check_plan();
+}
+
+#else /* ifdef ENABLE_ASAN */
 
 static char assert_msg_buf[128];
 
@@ -159,14 +519,14 @@ mempool_membership(void)
 	check_plan();
 }
 
-#endif /* ifdef ENABLE_ASAN */
+#endif /* ifndef ENABLE_ASAN */
 
 int main()
 {
 #ifdef ENABLE_ASAN
 	plan(3);
 #else
-	plan(2);
+	plan(9);
 #endif
 	header();
 
@@ -194,6 +554,14 @@ int main()
 	mempool_align();
 #ifdef ENABLE_ASAN
 	mempool_membership();
+#else
+	mempool_magazine();
+	mempool_batch();
+	mempool_pairing_heap();
+	mempool_remote();
+	mempool_layout();
+	mempool_defrag_test();
+	mempool_iterator_test();
 #endif
 
 	slab_cache_destroy(&cache);
@@ -1,11 +1,16 @@
 #include <small/slab_arena.h>
 #include <small/quota.h>
 #include <small/util.h>
+#include <small/small_features.h>
+#include <errno.h>
 #include <limits.h>
+#include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <sched.h>
+#include <sys/syscall.h>
 #include "unit.h"
 
 #ifndef ENABLE_ASAN
@@ -126,6 +131,496 @@ finish:
 	check_plan();
 }
 
+static void
+slab_test_hugepages(void)
+{
+	plan(4);
+	header();
+
+	struct slab_arena arena;
+	struct quota quota;
+	void *ptr;
+	size_t slab_size = 4 * 1024 * 1024;
+
+	quota_init(&quota, 4 * slab_size);
+	slab_arena_create(&arena, &quota, slab_size, slab_size,
+			  SLAB_ARENA_PRIVATE | SLAB_ARENA_HUGETLB);
+	/*
+	 * Both the preallocated and the dynamically mapped
+	 * slabs must be usable whatever backing is obtained.
+	 */
+	ptr = slab_map(&arena);
+	fail_unless(ptr != NULL);
+	memset(ptr, 0, slab_size);
+	void *ptr1 = slab_map(&arena);
+	fail_unless(ptr1 != NULL);
+	memset(ptr1, 0, slab_size);
+	ok(((uintptr_t)ptr1 & (slab_size - 1)) == 0);
+	/* Without hugetlb pages the arena falls back gracefully. */
+	ok(small_test_feature(SMALL_FEATURE_HUGETLB) ||
+	   !IS_SLAB_ARENA_FLAG(arena.flags, SLAB_ARENA_HUGETLB));
+	slab_unmap(&arena, ptr1);
+	slab_unmap(&arena, ptr);
+	slab_arena_destroy(&arena);
+
+	/* Not a multiple of a huge page, hugetlb is never used. */
+	quota_init(&quota, 4 * SLAB_MIN_SIZE);
+	slab_arena_create(&arena, &quota, 0, SLAB_MIN_SIZE,
+			  SLAB_ARENA_PRIVATE | SLAB_ARENA_HUGETLB);
+	ptr = slab_map(&arena);
+	fail_unless(ptr != NULL);
+	ok(!IS_SLAB_ARENA_FLAG(arena.flags, SLAB_ARENA_HUGETLB));
+	slab_unmap(&arena, ptr);
+	slab_arena_destroy(&arena);
+
+	quota_init(&quota, 4 * slab_size);
+	slab_arena_create(&arena, &quota, slab_size, slab_size,
+			  SLAB_ARENA_PRIVATE | SLAB_ARENA_THP);
+	ptr = slab_map(&arena);
+	fail_unless(ptr != NULL);
+	ok(!small_test_feature(SMALL_FEATURE_THP) ||
+	   access("/proc/self/smaps", F_OK) ||
+	   vma_has_flag((unsigned long)ptr, "hg"));
+	slab_unmap(&arena, ptr);
+	slab_arena_destroy(&arena);
+
+	footer();
+	check_plan();
+}
+
+static void
+slab_test_numa(void)
+{
+	plan(6);
+	header();
+
+	struct slab_arena arena;
+	struct quota quota;
+	void *ptrs[4];
+
+	/* Stay on one node for the slabs to be cached locally. */
+	cpu_set_t cpus, saved_cpus;
+	fail_unless(sched_getaffinity(0, sizeof(saved_cpus),
+				      &saved_cpus) == 0);
+	CPU_ZERO(&cpus);
+	CPU_SET(sched_getcpu(), &cpus);
+	sched_setaffinity(0, sizeof(cpus), &cpus);
+
+	quota_init(&quota, 4 * SLAB_MIN_SIZE);
+	slab_arena_create(&arena, &quota, 2 * SLAB_MIN_SIZE, SLAB_MIN_SIZE,
+			  SLAB_ARENA_PRIVATE | SLAB_ARENA_NUMA);
+	bool is_numa = IS_SLAB_ARENA_FLAG(arena.flags, SLAB_ARENA_NUMA);
+	note("NUMA mode is %s", is_numa ? "on" : "off");
+
+	for (int i = 0; i < 4; i++) {
+		ptrs[i] = slab_map(&arena);
+		fail_unless(ptrs[i] != NULL);
+		memset(ptrs[i], 0, SLAB_MIN_SIZE);
+	}
+	ok(slab_map(&arena) == NULL);
+
+	size_t node_used = 0;
+	for (int i = 0; i < SLAB_ARENA_NODE_MAX; i++)
+		node_used += arena.nodes[i].used;
+	ok(node_used == (is_numa ? arena.used : 0));
+
+	/* Cached slabs are reused before anything else. */
+	slab_unmap(&arena, ptrs[3]);
+	ok(slab_map(&arena) == ptrs[3]);
+
+	for (int i = 0; i < 4; i++)
+		slab_unmap(&arena, ptrs[i]);
+	size_t used = arena.used;
+	for (int i = 0; i < 4; i++)
+		ptrs[i] = slab_map(&arena);
+	ok(arena.used == used);
+	for (int i = 0; i < 4; i++)
+		slab_unmap(&arena, ptrs[i]);
+
+	if (is_numa) {
+		/* The thread is pinned, all slabs are local. */
+		unsigned cpu, node;
+		fail_unless(syscall(SYS_getcpu, &cpu, &node, NULL) == 0);
+		struct lf_lifo *cache =
+			&arena.nodes[node % SLAB_ARENA_NODE_MAX].cache;
+		size_t count = 0;
+		for (struct lf_lifo *elem = lf_lifo(cache->next);
+		     elem != NULL; elem = lf_lifo(elem->next))
+			count++;
+		size_t steals = 0;
+		for (int i = 0; i < SLAB_ARENA_NODE_MAX; i++)
+			steals += arena.nodes[i].steals;
+		ok(count == 4 && steals == 0);
+
+		/*
+		 * Pretend a preallocated slab moved to another node:
+		 * a batch holding it must not land on a single depot.
+		 */
+		for (int i = 0; i < 4; i++)
+			ptrs[i] = slab_map(&arena);
+		void *batch[2];
+		int n = 0;
+		for (int i = 0; i < 4; i++) {
+			if (n < 2 && ptrs[i] >= arena.arena &&
+			    ptrs[i] < arena.arena + arena.prealloc)
+				batch[n++] = ptrs[i];
+			else
+				slab_unmap(&arena, ptrs[i]);
+		}
+		fail_unless(n == 2);
+		unsigned other = (node + 1) % SLAB_ARENA_NODE_MAX;
+		size_t i = ((char *)batch[1] - (char *)arena.arena) /
+			   arena.slab_size;
+		arena.slab_nodes[i] = other;
+		slab_unmap_batch(&arena, batch, 2);
+		struct lf_lifo *depot =
+			&arena.nodes[node % SLAB_ARENA_NODE_MAX].depot;
+		ok((void *)lf_lifo(depot->next) == batch[0] &&
+		   (void *)lf_lifo(arena.nodes[other].cache.next) == batch[1]);
+	} else {
+		ok(true, "[SKIPPED] no NUMA support");
+		ok(true, "[SKIPPED] no NUMA support");
+	}
+	slab_arena_destroy(&arena);
+	sched_setaffinity(0, sizeof(saved_cpus), &saved_cpus);
+
+	footer();
+	check_plan();
+}
+
+/** Check if any page of a memory range is resident. */
+static bool
+is_resident(void *ptr, size_t size)
+{
+	size_t page_size = small_getpagesize();
+	unsigned char vec[size / page_size];
+	fail_unless(mincore(ptr, size, vec) == 0);
+	for (size_t i = 0; i < size / page_size; i++) {
+		if (vec[i] & 1)
+			return true;
+	}
+	return false;
+}
+
+static void
+slab_test_trim(void)
+{
+	plan(11);
+	header();
+
+	struct slab_arena arena;
+	struct quota quota;
+	void *ptrs[4];
+	size_t page_size = small_getpagesize();
+
+	quota_init(&quota, 4 * SLAB_MIN_SIZE);
+	slab_arena_create(&arena, &quota, 2 * SLAB_MIN_SIZE, SLAB_MIN_SIZE,
+			  SLAB_ARENA_PRIVATE);
+	for (int i = 0; i < 4; i++) {
+		ptrs[i] = slab_map(&arena);
+		fail_unless(ptrs[i] != NULL);
+		memset(ptrs[i], 'x', SLAB_MIN_SIZE);
+	}
+	ok(slab_arena_trim(&arena, 0) == 0);
+	for (int i = 0; i < 4; i++)
+		slab_unmap(&arena, ptrs[i]);
+	ok(arena.cached == 4 * SLAB_MIN_SIZE);
+	ok(quota_used(&quota) == 4 * SLAB_MIN_SIZE);
+
+	/* Trim in steps of one slab, keep one slab cached. */
+	ok(slab_arena_trim_step(&arena, SLAB_MIN_SIZE,
+				SLAB_MIN_SIZE) == SLAB_MIN_SIZE);
+	ok(slab_arena_trim(&arena, SLAB_MIN_SIZE) == 2 * SLAB_MIN_SIZE);
+	ok(arena.cached == SLAB_MIN_SIZE);
+	ok(quota_used(&quota) == SLAB_MIN_SIZE);
+	/* Only the page with the free list link may be resident. */
+	ok(!is_resident((char *)ptrs[3] + page_size,
+			SLAB_MIN_SIZE - page_size));
+
+	/* The cached slab goes first, then the trimmed ones. */
+	ok(slab_map(&arena) == ptrs[0]);
+	void *ptr = slab_map(&arena);
+	ok(ptr == ptrs[1] && ((char *)ptr)[SLAB_MIN_SIZE - 1] == 0);
+	ok(arena.used == 4 * SLAB_MIN_SIZE);
+	slab_unmap(&arena, ptr);
+	slab_unmap(&arena, ptrs[0]);
+	slab_arena_destroy(&arena);
+
+	footer();
+	check_plan();
+}
+
+static void
+slab_test_magazine(void)
+{
+	plan(9);
+	header();
+
+	struct slab_arena arena;
+	struct quota quota;
+	struct slab_magazine mag;
+	void *ptrs[9];
+	void *batch[4];
+
+	quota_init(&quota, 16 * SLAB_MIN_SIZE);
+	slab_arena_create(&arena, &quota, 16 * SLAB_MIN_SIZE, SLAB_MIN_SIZE,
+			  SLAB_ARENA_PRIVATE);
+	slab_magazine_create(&mag, &arena, 8);
+	for (int i = 0; i < 9; i++) {
+		ptrs[i] = slab_magazine_map(&mag);
+		fail_unless(ptrs[i] != NULL);
+		memset(ptrs[i], 'x', SLAB_MIN_SIZE);
+	}
+	ok(mag.count == 0);
+	for (int i = 0; i < 9; i++)
+		slab_magazine_unmap(&mag, ptrs[i]);
+	/* The oldest half has been flushed as a single batch. */
+	ok(mag.count == 5);
+	ok(arena.cached == 4 * SLAB_MIN_SIZE);
+
+	/* Take a part of the batch, the rest stays in the depot. */
+	ok(slab_map_batch(&arena, batch, 3) == 3);
+	ok(arena.cached == SLAB_MIN_SIZE);
+	ok(slab_map(&arena) == ptrs[0]);
+	ok(arena.cached == 0);
+	slab_unmap_batch(&arena, batch, 3);
+	slab_unmap(&arena, ptrs[0]);
+	ok(arena.cached == 4 * SLAB_MIN_SIZE);
+
+	slab_magazine_destroy(&mag);
+	ok(arena.cached == 9 * SLAB_MIN_SIZE);
+	slab_arena_destroy(&arena);
+
+	footer();
+	check_plan();
+}
+
+static void
+slab_test_prefault(void)
+{
+	plan(9);
+	header();
+
+	struct slab_arena arena;
+	struct quota quota;
+	void *ptrs[4];
+
+	quota_init(&quota, 8 * SLAB_MIN_SIZE);
+	slab_arena_create(&arena, &quota, 8 * SLAB_MIN_SIZE, SLAB_MIN_SIZE,
+			  SLAB_ARENA_PRIVATE);
+	ok(slab_arena_prefault(&arena, 2) == 2);
+	ok(arena.prefaulted == 2 * SLAB_MIN_SIZE);
+	ok(is_resident(arena.arena, SLAB_MIN_SIZE));
+	ok(!is_resident((char *)arena.arena + 2 * SLAB_MIN_SIZE,
+			SLAB_MIN_SIZE));
+	for (int i = 0; i < 3; i++)
+		fail_unless((ptrs[i] = slab_map(&arena)) != NULL);
+	ok(arena.counters.prefault_hits == 2);
+	ok(arena.counters.prefault_misses == 1);
+
+	/* The thread pre-faults the rest of the preallocated area. */
+	ok(slab_arena_prefault_start(&arena, 8) == 0);
+	struct timespec delay = {0, 1000000};
+	for (int i = 0; i < 10000 && arena.prefaulted < arena.prealloc; i++)
+		nanosleep(&delay, NULL);
+	ok(arena.prefaulted == arena.prealloc);
+	fail_unless((ptrs[3] = slab_map(&arena)) != NULL);
+	ok(arena.counters.prefault_hits == 3);
+	for (int i = 0; i < 4; i++)
+		slab_unmap(&arena, ptrs[i]);
+	slab_arena_destroy(&arena);
+
+	footer();
+	check_plan();
+}
+
+static void
+slab_test_file(void)
+{
+	plan(13);
+	header();
+
+	struct slab_arena arena;
+	struct quota quota;
+	FILE *file = tmpfile();
+	fail_unless(file != NULL);
+	int fd = fileno(file);
+
+	quota_init(&quota, 4 * SLAB_MIN_SIZE);
+	ok(slab_arena_create_file(&arena, &quota, fd, 4 * SLAB_MIN_SIZE,
+				  SLAB_MIN_SIZE, SLAB_ARENA_SHARED) == 0);
+	void *base = arena.arena;
+	char *data = slab_map(&arena);
+	void *spare = slab_map(&arena);
+	fail_unless(data == base && spare != NULL);
+	strcpy(data, "persistent");
+	slab_unmap(&arena, spare);
+	slab_arena_destroy(&arena);
+
+	/* Remap the arena and find everything in place. */
+	quota_init(&quota, 4 * SLAB_MIN_SIZE);
+	ok(slab_arena_create_file(&arena, &quota, fd, 0, SLAB_MIN_SIZE,
+				  SLAB_ARENA_SHARED) == 0);
+	ok(arena.arena == base);
+	ok(arena.prealloc == 4 * SLAB_MIN_SIZE);
+	ok(arena.used == 2 * SLAB_MIN_SIZE);
+	ok(quota_used(&quota) == 2 * SLAB_MIN_SIZE);
+	ok(strcmp(data, "persistent") == 0);
+	ok(slab_map(&arena) == spare);
+
+	/* The arena does not grow beyond the file. */
+	fail_unless(slab_map(&arena) != NULL);
+	fail_unless(slab_map(&arena) != NULL);
+	ok(slab_map(&arena) == NULL);
+	ok(arena.used == arena.prealloc);
+	slab_arena_destroy(&arena);
+
+	/* A truncated file is refused rather than crashes. */
+	fail_unless(ftruncate(fd, small_getpagesize() +
+			      2 * SLAB_MIN_SIZE) == 0);
+	quota_init(&quota, 4 * SLAB_MIN_SIZE);
+	errno = 0;
+	ok(slab_arena_create_file(&arena, &quota, fd, 0, SLAB_MIN_SIZE,
+				  SLAB_ARENA_SHARED) == -1 && errno == EINVAL);
+	ok(quota_used(&quota) == 0);
+	fclose(file);
+
+	/* So is a file with a corrupted list of cached slabs. */
+	file = tmpfile();
+	fail_unless(file != NULL);
+	fd = fileno(file);
+	quota_init(&quota, 4 * SLAB_MIN_SIZE);
+	fail_unless(slab_arena_create_file(&arena, &quota, fd,
+					   4 * SLAB_MIN_SIZE, SLAB_MIN_SIZE,
+					   SLAB_ARENA_SHARED) == 0);
+	void *slab = slab_map(&arena);
+	fail_unless(slab != NULL);
+	slab_unmap(&arena, slab);
+	/* Make the cached slab link outside of the arena. */
+	lf_lifo(slab)->next = (char *)arena.arena + arena.prealloc;
+	slab_arena_destroy(&arena);
+	quota_init(&quota, 4 * SLAB_MIN_SIZE);
+	errno = 0;
+	ok(slab_arena_create_file(&arena, &quota, fd, 0, SLAB_MIN_SIZE,
+				  SLAB_ARENA_SHARED) == -1 && errno == EINVAL);
+	fclose(file);
+
+	footer();
+	check_plan();
+}
+
+static void
+slab_test_reserve(void)
+{
+	plan(7);
+	header();
+
+	struct slab_arena arena;
+	struct quota quota;
+	enum { SLAB_COUNT = 4 * SLAB_ARENA_COMMIT_CHUNK };
+	void *ptrs[SLAB_COUNT + 1];
+	size_t chunk = SLAB_ARENA_COMMIT_CHUNK * SLAB_MIN_SIZE;
+
+	quota_init(&quota, (SLAB_COUNT + 1) * SLAB_MIN_SIZE);
+	ok(slab_arena_create(&arena, &quota, SLAB_COUNT * SLAB_MIN_SIZE,
+			     SLAB_MIN_SIZE, SLAB_ARENA_PRIVATE |
+			     SLAB_ARENA_RESERVE) == 0);
+	ok(arena.committed == 0);
+	for (int i = 0; i < SLAB_ARENA_COMMIT_CHUNK + 1; i++) {
+		ptrs[i] = slab_map(&arena);
+		fail_unless(ptrs[i] != NULL);
+		memset(ptrs[i], 'x', SLAB_MIN_SIZE);
+	}
+	/* Slabs are contiguous and committed in chunks. */
+	ok(ptrs[SLAB_ARENA_COMMIT_CHUNK] ==
+	   (char *)ptrs[0] + chunk);
+	ok(arena.committed == 2 * chunk);
+
+	/* Pre-faulting commits memory too. */
+	ok(slab_arena_prefault(&arena, SLAB_COUNT) ==
+	   SLAB_COUNT - SLAB_ARENA_COMMIT_CHUNK - 1);
+	ok(arena.committed == arena.prealloc);
+
+	/* Beyond the reserved area slabs are mmap()ed one by one. */
+	for (int i = SLAB_ARENA_COMMIT_CHUNK + 1; i < SLAB_COUNT + 1; i++) {
+		ptrs[i] = slab_map(&arena);
+		fail_unless(ptrs[i] != NULL);
+		memset(ptrs[i], 'x', SLAB_MIN_SIZE);
+	}
+	ok(arena.used == (SLAB_COUNT + 1) * SLAB_MIN_SIZE);
+	for (int i = 0; i < SLAB_COUNT + 1; i++)
+		slab_unmap(&arena, ptrs[i]);
+	slab_arena_destroy(&arena);
+
+	footer();
+	check_plan();
+}
+
+static void
+slab_test_stats(void)
+{
+	plan(12);
+	header();
+
+	struct slab_arena arena;
+	struct quota quota;
+	struct slab_arena_stats stats;
+	void *ptrs[3];
+
+	quota_init(&quota, 3 * SLAB_MIN_SIZE);
+	slab_arena_create(&arena, &quota, 2 * SLAB_MIN_SIZE, SLAB_MIN_SIZE,
+			  SLAB_ARENA_PRIVATE);
+	slab_arena_stats(&arena, &stats);
+	size_t mmaps = stats.counters.mmaps;
+	ok(stats.counters.fresh_maps == 0 && stats.used == 0);
+
+	/* Two slabs are preallocated, the third one is mmap()ed. */
+	for (int i = 0; i < 3; i++)
+		fail_unless((ptrs[i] = slab_map(&arena)) != NULL);
+	ok(slab_map(&arena) == NULL);
+	slab_arena_stats(&arena, &stats);
+	ok(stats.counters.fresh_maps == 3);
+	ok(stats.counters.mmaps > mmaps);
+	ok(stats.counters.quota_refusals == 1);
+	ok(stats.counters.cache_hits == 0);
+
+	slab_unmap(&arena, ptrs[2]);
+	slab_unmap(&arena, ptrs[1]);
+	fail_unless((ptrs[1] = slab_map(&arena)) != NULL);
+	slab_arena_stats(&arena, &stats);
+	ok(stats.counters.cache_hits == 1);
+	ok(stats.cached == SLAB_MIN_SIZE);
+	ok(stats.used == 3 * SLAB_MIN_SIZE);
+	ok(stats.counters.peak_used == 3 * SLAB_MIN_SIZE);
+	slab_unmap(&arena, ptrs[0]);
+	slab_unmap(&arena, ptrs[1]);
+	slab_arena_destroy(&arena);
+
+	/* Statistics of a file backed arena survive a restart. */
+	FILE *file = tmpfile();
+	fail_unless(file != NULL);
+	quota_init(&quota, 4 * SLAB_MIN_SIZE);
+	fail_unless(slab_arena_create_file(&arena, &quota, fileno(file),
+					   4 * SLAB_MIN_SIZE, SLAB_MIN_SIZE,
+					   SLAB_ARENA_SHARED) == 0);
+	for (int i = 0; i < 2; i++)
+		fail_unless(slab_map(&arena) != NULL);
+	fail_unless(slab_arena_sync(&arena) == 0);
+	slab_arena_destroy(&arena);
+	quota_init(&quota, 4 * SLAB_MIN_SIZE);
+	fail_unless(slab_arena_create_file(&arena, &quota, fileno(file),
+					   0, SLAB_MIN_SIZE,
+					   SLAB_ARENA_SHARED) == 0);
+	slab_arena_stats(&arena, &stats);
+	ok(stats.used == 2 * SLAB_MIN_SIZE);
+	ok(stats.counters.peak_used == 2 * SLAB_MIN_SIZE);
+	slab_arena_destroy(&arena);
+	fclose(file);
+
+	footer();
+	check_plan();
+}
+
 #else /* ifdef ENABLE_ASAN */
 
 static char assert_msg_buf[128];
@@ -224,7 +719,11 @@ slab_test_basic(void)
 int
 main(void)
 {
+#ifdef ENABLE_ASAN
 	plan(2);
+#else
+	plan(10);
+#endif
 	header();
 
 	slab_test_basic();
@@ -232,6 +731,14 @@ main(void)
 	slab_test_membership();
 #else
 	slab_test_madvise();
+	slab_test_hugepages();
+	slab_test_numa();
+	slab_test_trim();
+	slab_test_magazine();
+	slab_test_prefault();
+	slab_test_file();
+	slab_test_reserve();
+	slab_test_stats();
 #endif
 
 	footer();
@@ -5,6 +5,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include "unit.h"
 
 struct quota quota;
@@ -87,6 +89,325 @@ test_slab_real_size(void)
 	check_plan();
 }
 
+static void
+test_slab_gc(void)
+{
+	plan(7);
+	header();
+
+	slab_arena_create(&arena, &quota, 0, 4000000, MAP_PRIVATE);
+	slab_cache_create(&cache, &arena);
+	size_t slab_size = arena.slab_size;
+
+	struct slab *a = slab_get_with_order(&cache, cache.order_max);
+	struct slab *b = slab_get_with_order(&cache, cache.order_max);
+	/* The first slab is kept as a spare, the second one goes. */
+	slab_put(&cache, a);
+	slab_put(&cache, b);
+	ok(arena.cached == slab_size);
+	/* The spare has not been idle for a whole period yet. */
+	ok(slab_cache_gc(&cache, SIZE_MAX) == 0);
+	ok(slab_cache_gc(&cache, 0) == 0);
+	ok(slab_cache_gc(&cache, SIZE_MAX) == slab_size);
+	ok(arena.cached == 2 * slab_size);
+
+	/* Splitting the spare makes it busy for the period. */
+	a = slab_get_with_order(&cache, cache.order_max);
+	slab_put(&cache, a);
+	slab_cache_gc(&cache, SIZE_MAX);
+	a = slab_get_with_order(&cache, 0);
+	slab_put(&cache, a);
+	ok(slab_cache_gc(&cache, SIZE_MAX) == 0);
+	ok(slab_cache_gc(&cache, SIZE_MAX) == slab_size);
+
+	slab_cache_destroy(&cache);
+	slab_arena_destroy(&arena);
+
+	footer();
+	check_plan();
+}
+
+static void
+test_slab_large_cache(void)
+{
+	plan(11);
+	header();
+
+	slab_arena_create(&arena, &quota, 0, 4000000, MAP_PRIVATE);
+	slab_cache_create(&cache, &arena);
+	slab_cache_set_large_cache_size(&cache, 20000000);
+	size_t used = quota_used(&quota);
+
+	struct slab *a = slab_get(&cache, 6000000);
+	slab_put(&cache, a);
+	ok(cache.large_cached == a->size);
+	/* The released slab keeps its quota. */
+	ok(quota_used(&quota) > used);
+	/* A slab up to twice bigger than needed is reused. */
+	struct slab *b = slab_get(&cache, 5000000);
+	ok(b == a && cache.large_cached == 0);
+	ok(slab_cache_used(&cache) == a->size);
+	slab_cache_check(&cache);
+	slab_put(&cache, b);
+	/* A smaller one is not. */
+	struct slab *c = slab_get(&cache, 7000000);
+	ok(c != a);
+	slab_put(&cache, c);
+	/* The least recently released slabs go over the budget. */
+	struct slab *d = slab_get(&cache, 15000000);
+	slab_put(&cache, d);
+	ok(cache.large_cached == d->size);
+	/* A more than twice bigger slab is not reused either. */
+	struct slab *e = slab_get(&cache, 5000000);
+	ok(e != d);
+	size_t e_size = e->size;
+	slab_put(&cache, e);
+	/* Cached slabs decay like free ordered slabs. */
+	ok(slab_cache_gc(&cache, SIZE_MAX) == 0);
+	ok(slab_cache_gc(&cache, SIZE_MAX) == e_size);
+	slab_cache_set_large_cache_size(&cache, 0);
+	ok(cache.large_cached == 0);
+	ok(quota_used(&quota) == used);
+
+	slab_cache_destroy(&cache);
+	slab_arena_destroy(&arena);
+
+	footer();
+	check_plan();
+}
+
+static void
+test_slab_large_cache_quota(void)
+{
+	plan(5);
+	header();
+
+	struct quota tight;
+	quota_init(&tight, 8 * 1024 * 1024);
+	slab_arena_create(&arena, &tight, 0, 4000000, MAP_PRIVATE);
+	slab_cache_create(&cache, &arena);
+	slab_cache_set_large_cache_size(&cache, 20000000);
+
+	struct slab *a = slab_get(&cache, 7000000);
+	fail_unless(a != NULL);
+	slab_put(&cache, a);
+	ok(cache.large_cached == a->size);
+	/* The cached slab is too small, but gives away its quota. */
+	struct slab *b = slab_get(&cache, 7500000);
+	ok(b != NULL && cache.large_cached == 0);
+	slab_put(&cache, b);
+	/* So does a cached slab for an ordered one. */
+	struct slab *c = slab_get(&cache, 1000);
+	ok(c != NULL && cache.large_cached == 0);
+	ok(quota_used(&tight) == arena.slab_size);
+	slab_put(&cache, c);
+	slab_cache_destroy(&cache);
+	slab_arena_destroy(&arena);
+	ok(quota_used(&tight) == arena.slab_size);
+
+	footer();
+	check_plan();
+}
+
+static void
+test_slab_grow_large(void)
+{
+	plan(5);
+	header();
+
+	slab_arena_create(&arena, &quota, 0, 4000000, MAP_PRIVATE);
+	slab_cache_create(&cache, &arena);
+	size_t used = quota_used(&quota);
+
+	size_t size = 64 * 1024 * 1024 + 100;
+	struct slab *slab = slab_get(&cache, size);
+	fail_unless(slab != NULL);
+	char *data = (char *) slab_data(slab);
+	data[0] = 'a';
+	data[size - 1] = 'z';
+	slab = slab_grow_large(&cache, slab, 2 * size, 0, size);
+	ok(slab != NULL);
+	ok(slab_cache_used(&cache) == slab->size &&
+	   cache.allocated.stats.total == slab->size);
+	data = (char *) slab_data(slab);
+	ok(data[0] == 'a' && data[size - 1] == 'z');
+#if defined(TARANTOOL_SMALL_HAVE_MREMAP)
+	/* Copying would have faulted in every page of the slab. */
+	size_t page_size = small_getpagesize();
+	size_t pages = slab->size / page_size;
+	unsigned char *vec = malloc(pages);
+	fail_unless(mincore(slab, slab->size, vec) == 0);
+	size_t resident = 0;
+	for (size_t i = 0; i < pages; i++)
+		resident += vec[i] & 1;
+	free(vec);
+	ok(resident < pages / 100);
+#else
+	ok(true, "[SKIPPED] no mremap() support");
+#endif
+	slab_put(&cache, slab);
+	ok(quota_used(&quota) == used);
+	slab_cache_destroy(&cache);
+	slab_arena_destroy(&arena);
+
+	footer();
+	check_plan();
+}
+
+static void
+pin_count_cb(struct slab *slab, size_t stranded, void *arg)
+{
+	(void) slab;
+	size_t *pinned = arg;
+	pinned[0]++;
+	pinned[1] = stranded;
+}
+
+static void
+test_slab_fragmentation(void)
+{
+	plan(8);
+	header();
+
+	slab_arena_create(&arena, &quota, 0, 4000000, MAP_PRIVATE);
+	slab_cache_create(&cache, &arena);
+
+	/* Fill an arena slab with order 0 slabs, free every other. */
+	size_t count = 1 << cache.order_max;
+	struct slab **slabs = calloc(count, sizeof(*slabs));
+	fail_unless(slabs != NULL);
+	for (size_t i = 0; i < count; i++)
+		slabs[i] = slab_get_with_order(&cache, 0);
+	for (size_t i = 0; i < count; i += 2)
+		slab_put(&cache, slabs[i]);
+	struct slab *big = slab_get_with_order(&cache, 2);
+
+	struct slab_cache_fragmentation frag;
+	size_t pinned[2] = {0, 0};
+	slab_cache_fragmentation(&cache, &frag, pin_count_cb, pinned);
+	size_t order0 = slab_order_size(&cache, 0);
+	ok(frag.split == 2);
+	/* The order 2 slab is split from another arena slab. */
+	ok(frag.stranded == count / 2 * order0 +
+	   arena.slab_size - slab_order_size(&cache, 2));
+	ok(frag.orders[0].split == 1);
+	ok(frag.orders[0].stranded == count / 2 * order0);
+	ok(frag.orders[2].split == 1);
+	/* All the used order 0 slabs and the order 2 slab. */
+	ok(pinned[0] == count / 2 + 1);
+
+	for (size_t i = 1; i < count; i += 2)
+		slab_put(&cache, slabs[i]);
+	slab_put(&cache, big);
+	slab_cache_fragmentation(&cache, &frag, NULL, NULL);
+	ok(frag.split == 0);
+	ok(frag.stranded == 0);
+	free(slabs);
+
+	slab_cache_destroy(&cache);
+	slab_arena_destroy(&arena);
+
+	footer();
+	check_plan();
+}
+
+static void
+test_slab_batch(void)
+{
+	plan(7);
+	header();
+
+	slab_arena_create(&arena, &quota, 0, 4000000, MAP_PRIVATE);
+	slab_cache_create(&cache, &arena);
+
+	/* More than an arena slab can hold. */
+	size_t count = (1 << cache.order_max) + 100;
+	struct slab **slabs = calloc(count, sizeof(*slabs));
+	fail_unless(slabs != NULL);
+	size_t order0 = slab_order_size(&cache, 0);
+	ok(slab_get_batch(&cache, 0, count, slabs) == count);
+	ok(slab_cache_used(&cache) == count * order0);
+	bool valid = true;
+	for (size_t i = 0; i < count; i++) {
+		valid = valid && slabs[i]->order == 0 &&
+			((uintptr_t) slabs[i] & (order0 - 1)) == 0;
+		memset(slab_data(slabs[i]), 0, slab_capacity(slabs[i]));
+	}
+	ok(valid);
+	slab_cache_check(&cache);
+	/* The rest of the cut slab is usable. */
+	struct slab *slab = slab_get_with_order(&cache, 3);
+	fail_unless(slab != NULL);
+	slab_cache_check(&cache);
+	slab_put_batch(&cache, slabs, count / 2);
+	ok(slab_cache_used(&cache) ==
+	   (count - count / 2) * order0 + slab_order_size(&cache, 3));
+	slab_cache_check(&cache);
+	ok(slab_get_batch(&cache, 1, 10, slabs) == 10);
+	slab_cache_check(&cache);
+	slab_put_batch(&cache, slabs, 10);
+	slab_put_batch(&cache, slabs + count / 2, count - count / 2);
+	slab_put(&cache, slab);
+	ok(slab_cache_used(&cache) == 0);
+	slab_cache_check(&cache);
+	struct slab_cache_fragmentation frag;
+	slab_cache_fragmentation(&cache, &frag, NULL, NULL);
+	ok(frag.split == 0);
+	free(slabs);
+
+	slab_cache_destroy(&cache);
+	slab_arena_destroy(&arena);
+
+	footer();
+	check_plan();
+}
+
+enum { REMOTE_SLABS = 16 };
+
+static void *
+put_remote_f(void *arg)
+{
+	struct slab **slabs = arg;
+	for (int i = 0; i < REMOTE_SLABS; i++)
+		slab_put_remote(&cache, slabs[i]);
+	return NULL;
+}
+
+static void
+test_slab_put_remote(void)
+{
+	plan(3);
+	header();
+
+	slab_arena_create(&arena, &quota, 0, 4000000, MAP_PRIVATE);
+	slab_cache_create(&cache, &arena);
+
+	struct slab *slabs[REMOTE_SLABS];
+	for (int i = 0; i < REMOTE_SLABS; i++) {
+		/* Ordered slabs of all sizes and a large one. */
+		size_t size = i < REMOTE_SLABS - 1 ? (1 << i) * 100 : 8000000;
+		slabs[i] = slab_get(&cache, size);
+		fail_unless(slabs[i] != NULL);
+	}
+	size_t used = slab_cache_used(&cache);
+	pthread_t thread;
+	fail_unless(pthread_create(&thread, NULL, put_remote_f, slabs) == 0);
+	pthread_join(thread, NULL);
+	/* The slabs are freed by the owner only. */
+	ok(slab_cache_used(&cache) == used);
+	struct slab *slab = slab_get(&cache, 100);
+	ok(slab_cache_used(&cache) == slab->size);
+	slab_put(&cache, slab);
+	ok(slab_cache_used(&cache) == 0);
+	slab_cache_check(&cache);
+
+	slab_cache_destroy(&cache);
+	slab_arena_destroy(&arena);
+
+	footer();
+	check_plan();
+}
+
 #else
 
 static char assert_msg_buf[128];
@@ -154,7 +475,7 @@ main(void)
 #ifdef ENABLE_ASAN
 	plan(3);
 #else
-	plan(2);
+	plan(9);
 #endif
 	header();
 
@@ -169,6 +490,13 @@ main(void)
 	test_slab_alignment();
 #else
 	test_slab_real_size();
+	test_slab_gc();
+	test_slab_large_cache();
+	test_slab_large_cache_quota();
+	test_slab_grow_large();
+	test_slab_fragmentation();
+	test_slab_batch();
+	test_slab_put_remote();
 #endif
 
 	footer();
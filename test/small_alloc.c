@@ -2,6 +2,7 @@
 #include <small/quota.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
 #include <time.h>
 #include "unit.h"
@@ -120,6 +121,61 @@ small_alloc_basic(void)
 	check_plan();
 }
 
+static void
+small_alloc_nosize(void)
+{
+	plan(2);
+	header();
+
+	float actual_alloc_factor;
+	small_alloc_create(&alloc, &cache, OBJSIZE_MIN,
+			   sizeof(intptr_t), 1.3,
+			   &actual_alloc_factor);
+	small_alloc_enable_nosize(&alloc);
+	/* Small objects of all sizes and a few large ones. */
+	size_t large_size = 2 * arena.slab_size;
+	for (int i = 0; i < OBJECTS_MAX; i++) {
+		size_t size = i % 100 == 0 ? large_size + i :
+			      OBJSIZE_MIN + (size_t)(rand() % 100000);
+		ptrs[i] = smalloc(&alloc, size);
+		fail_unless(ptrs[i] != NULL);
+		memset(ptrs[i], 0, size);
+		memcpy(ptrs[i], &size, sizeof(size));
+	}
+	/* Both ways to free may be mixed. */
+	for (int i = 0; i < OBJECTS_MAX; i++) {
+		size_t size;
+		memcpy(&size, ptrs[i], sizeof(size));
+#ifndef ENABLE_ASAN
+		/* Any size beyond objsize_max frees a large object. */
+		if (i % 200 == 0)
+			smfree(&alloc, ptrs[i], alloc.objsize_max + 1);
+		else
+#endif
+		if (i % 2 == 1)
+			smfree(&alloc, ptrs[i], size);
+		else
+			smfree_nosize(&alloc, ptrs[i]);
+		ptrs[i] = NULL;
+	}
+	small_check_unused();
+#ifndef ENABLE_ASAN
+	/* Size classes allocate from their own pools, no waste. */
+	bool no_waste = true;
+	for (uint32_t i = 0; i < alloc.small_mempool_cache_size; i++) {
+		struct small_mempool *pool = &alloc.small_mempool_cache[i];
+		no_waste = no_waste && pool->waste == 0 &&
+			   pool->used_pool == pool;
+	}
+#endif
+	ok_no_asan(no_waste);
+	small_alloc_destroy(&alloc);
+	ok(true);
+
+	footer();
+	check_plan();
+}
+
 #ifndef ENABLE_ASAN
 
 static void
@@ -137,6 +193,60 @@ small_alloc_large(void)
 	check_plan();
 }
 
+static int
+small_used_cb(const void *stats, void *arg)
+{
+	(void)stats;
+	(void)arg;
+	return 0;
+}
+
+static void
+small_alloc_tcache(void)
+{
+	plan(3);
+	header();
+
+	float actual_alloc_factor;
+	small_alloc_create(&alloc, &cache, OBJSIZE_MIN,
+			   sizeof(intptr_t), 1.3,
+			   &actual_alloc_factor);
+	small_alloc_set_tcache_size(&alloc, 16);
+	/* The last freed object is reused first. */
+	void *ptr = smalloc(&alloc, 100);
+	fail_unless(ptr != NULL);
+	smfree(&alloc, ptr, 100);
+	ok(smalloc(&alloc, 100) == ptr);
+	smfree(&alloc, ptr, 100);
+
+	memset(ptrs, 0, sizeof(ptrs));
+	allocating = true;
+	for (int i = 0; i < 1000; i++) {
+		int oscillation = rand() % 1024;
+		for (int j = 0; j < oscillation; ++j) {
+			int pos = rand() % OBJECTS_MAX;
+			alloc_checked(pos, OBJSIZE_MIN, 5000);
+		}
+		allocating = ! allocating;
+	}
+	for (int pos = 0; pos < OBJECTS_MAX; pos++) {
+		if (ptrs[pos] != NULL)
+			free_checked(ptrs[pos]);
+	}
+	/* Cached objects are counted as used until flushed. */
+	struct small_stats totals;
+	small_stats(&alloc, &totals, small_used_cb, NULL);
+	ok(totals.used > 0);
+	small_alloc_set_tcache_size(&alloc, 0);
+	small_check_unused();
+	ok(true);
+	small_alloc_destroy(&alloc);
+	allocating = true;
+
+	footer();
+	check_plan();
+}
+
 static inline void
 check_small_alloc_info(struct small_alloc *alloc, size_t size, bool is_large,
 		       size_t real_size)
@@ -359,9 +469,9 @@ small_membership(void)
 int main()
 {
 #ifdef ENABLE_ASAN
-	plan(3);
+	plan(4);
 #else
-	plan(5);
+	plan(7);
 #endif
 	header();
 
@@ -375,11 +485,13 @@ int main()
 	slab_cache_create(&cache, &arena);
 
 	small_alloc_basic();
+	small_alloc_nosize();
 #ifndef ENABLE_ASAN
 	small_alloc_large();
 	test_small_alloc_info();
 	test_small_alloc_info_gh_10217();
 	small_alloc_low_alloc_factor();
+	small_alloc_tcache();
 #else
 	small_wrong_size_in_free();
 	small_membership();